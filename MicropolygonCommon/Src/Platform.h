@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// Platform.h -- Stand-ins for the bits of the Windows headers we use, for building
+// the renderer on non-Windows platforms.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Basic Windows types.
+typedef int				INT;
+typedef unsigned int	UINT;
+typedef int				BOOL;
+typedef uint8_t			BYTE;
+typedef uint32_t		DWORD;
+
+#ifndef TRUE
+#define TRUE	1
+#define FALSE	0
+#endif
+
+// Memory helpers.
+#define ZeroMemory(Dest, Length)	memset((void*) (Dest), 0, (Length))
+
+// Debug asserts (normally from crtdbg.h).
+#define _ASSERT(Expr)	assert(Expr)
+#define _ASSERTE(Expr)	assert(Expr)
+
+#endif
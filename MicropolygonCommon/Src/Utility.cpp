@@ -13,6 +13,8 @@ namespace MicropolygonCommon
 // cTimer implementation.
 //--------------------------------------------------------------------------------------
 
+#ifdef _WIN32
+
 cTiming::cTiming()
 {
 	// Get performance counter frequency.
@@ -31,4 +33,22 @@ double cTiming::GetSeconds() const
 	return (double) count.QuadPart * m_PerfCounterPeriod;
 }
 
+#else
+
+cTiming::cTiming()
+{
+	// The monotonic clock counts in nanoseconds.
+	m_PerfCounterPeriod = 1.0e-9;
+}
+
+double cTiming::GetSeconds() const
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double) now.tv_sec + (double) now.tv_nsec * m_PerfCounterPeriod;
+}
+
+#endif
+
 }
@@ -40,12 +40,25 @@ private:
 template <typename T>
 inline T* AlignedAlloc(size_t count)
 {
+#ifdef _WIN32
 	return static_cast<T*>(_aligned_malloc(count * sizeof(T), alignof(T)));
+#else
+	// posix_memalign requires the alignment to be at least the size of a pointer.
+	const size_t Alignment = alignof(T) > sizeof(void*) ? alignof(T) : sizeof(void*);
+	void* ptr = NULL;
+	if (posix_memalign(&ptr, Alignment, count * sizeof(T)) != 0)
+		return NULL;
+	return static_cast<T*>(ptr);
+#endif
 }
 
 inline void AlignedFree(void* ptr)
 {
+#ifdef _WIN32
 	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
 }
 
 }
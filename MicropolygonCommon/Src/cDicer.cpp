@@ -0,0 +1,186 @@
+//--------------------------------------------------------------------------------------
+// Forward-differencing quad dicer.
+//--------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "cDicer.h"
+#include "cQuad.h"
+#include "cGrid.h"
+
+#if defined(_XM_SSE_INTRINSICS_)
+#include <emmintrin.h>
+#endif
+
+namespace MicropolygonCommon
+{
+
+namespace
+{
+
+// Lane offsets for generating four consecutive vertices at once.
+const XMVECTORF32 LaneIndex = { 0.0f, 1.0f, 2.0f, 3.0f };
+
+//--------------------------------------------------------------------------------------
+// Pack four colours held in structure-of-arrays form into XMUSHORTN4s.
+//--------------------------------------------------------------------------------------
+void PackUShortN4x4(FXMVECTOR r, FXMVECTOR g, FXMVECTOR b, FXMVECTOR a, XMUSHORTN4* Out)
+{
+#if defined(_XM_SSE_INTRINSICS_)
+
+	// Convert to [0,65535] integers, biased down so the signed saturating pack
+	// preserves the full unsigned range.
+	const XMVECTOR Scale = XMVectorReplicate(65535.0f);
+	const __m128i Bias = _mm_set1_epi32(32768);
+	auto ToBiasedInt = [&](FXMVECTOR c)
+	{
+		return _mm_sub_epi32(_mm_cvtps_epi32(XMVectorSaturate(c) * Scale), Bias);
+	};
+
+	// r0 r1 r2 r3 g0 g1 g2 g3 and b0 b1 b2 b3 a0 a1 a2 a3.
+	const __m128i rg = _mm_packs_epi32(ToBiasedInt(r), ToBiasedInt(g));
+	const __m128i ba = _mm_packs_epi32(ToBiasedInt(b), ToBiasedInt(a));
+
+	// r0 g0 r1 g1 r2 g2 r3 g3 and b0 a0 b1 a1 b2 a2 b3 a3.
+	const __m128i rgrg = _mm_unpacklo_epi16(rg, _mm_srli_si128(rg, 8));
+	const __m128i baba = _mm_unpacklo_epi16(ba, _mm_srli_si128(ba, 8));
+
+	// Interleave into whole colours and undo the bias.
+	const __m128i Unbias = _mm_set1_epi16((short) 0x8000);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&Out[0]), _mm_xor_si128(_mm_unpacklo_epi32(rgrg, baba), Unbias));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&Out[2]), _mm_xor_si128(_mm_unpackhi_epi32(rgrg, baba), Unbias));
+
+#else
+
+	XMVECTORF32 R, G, B, A;
+	R.v = r; G.v = g; B.v = b; A.v = a;
+	for (int i = 0; i < 4; i++)
+	{
+		XMStoreUShortN4(&Out[i], XMVectorSet(R.f[i], G.f[i], B.f[i], A.f[i]));
+	}
+
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Four consecutive vertices along a grid row in structure-of-arrays form, plus the
+// per-vertex step of each channel. Channels are position x, y, z then colour r, g, b, a.
+//--------------------------------------------------------------------------------------
+class cSoAVertices
+{
+public:
+
+	// Set lane i to Start + i * Step.
+	void Init(FXMVECTOR StartPos, FXMVECTOR StartColour, FXMVECTOR StepPos, GXMVECTOR StepColour)
+	{
+		SetChannel(0, XMVectorSplatX(StartPos), XMVectorSplatX(StepPos));
+		SetChannel(1, XMVectorSplatY(StartPos), XMVectorSplatY(StepPos));
+		SetChannel(2, XMVectorSplatZ(StartPos), XMVectorSplatZ(StepPos));
+		SetChannel(3, XMVectorSplatX(StartColour), XMVectorSplatX(StepColour));
+		SetChannel(4, XMVectorSplatY(StartColour), XMVectorSplatY(StepColour));
+		SetChannel(5, XMVectorSplatZ(StartColour), XMVectorSplatZ(StepColour));
+		SetChannel(6, XMVectorSplatW(StartColour), XMVectorSplatW(StepColour));
+	}
+
+	// Move on to the next four vertices.
+	void Advance()
+	{
+		for (int c = 0; c < NumChannels; c++)
+		{
+			m_Values[c] += m_Steps[c];
+		}
+	}
+
+	// Write the four vertices to the grid starting at (x, y). x must be a multiple of
+	// four, and may run into the row's padding.
+	void Store(cGrid& Grid, int x, int y) const
+	{
+		XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(Grid.GetXRow(y) + x), m_Values[0]);
+		XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(Grid.GetYRow(y) + x), m_Values[1]);
+		XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(Grid.GetZRow(y) + x), m_Values[2]);
+		PackUShortN4x4(m_Values[3], m_Values[4], m_Values[5], m_Values[6], Grid.GetColourRow(y) + x);
+	}
+
+private:
+
+	enum { NumChannels = 7 };
+
+	void SetChannel(int c, FXMVECTOR Start, FXMVECTOR Step)
+	{
+		m_Values[c] = XMVectorMultiplyAdd(LaneIndex, Step, Start);
+		m_Steps[c] = XMVectorScale(Step, 4.0f);
+	}
+
+	XMVECTOR	m_Values[NumChannels];
+	XMVECTOR	m_Steps[NumChannels];
+};
+
+}
+
+//--------------------------------------------------------------------------------------
+// Fill in every vertex of Grid from the bilinear patch defined by Quad.
+//--------------------------------------------------------------------------------------
+void cDicer::Dice(const cQuad& Quad, cGrid& Grid)
+{
+	const int NumPolysX = Grid.GetNumPolysX();
+	const int NumPolysY = Grid.GetNumPolysY();
+	const int RowStride = Grid.GetRowStride();
+	const float InvNumPolysX = 1.0f / (float) NumPolysX;
+	const float InvNumPolysY = 1.0f / (float) NumPolysY;
+
+	// Corners. Verts 0 & 1 are the ends of the first row, 2 & 3 the ends of the last.
+	XMVECTOR Pos[4];
+	XMVECTOR Colour[4];
+	for (int i = 0; i < 4; i++)
+	{
+		Pos[i] = Quad.m_Verts[i].GetPos();
+		Colour[i] = Quad.m_Verts[i].GetColour();
+	}
+
+	// Forward differences down the left and right edges.
+	const XMVECTOR LeftPosStep = (Pos[2] - Pos[0]) * InvNumPolysY;
+	const XMVECTOR LeftColourStep = (Colour[2] - Colour[0]) * InvNumPolysY;
+	const XMVECTOR RightPosStep = (Pos[3] - Pos[1]) * InvNumPolysY;
+	const XMVECTOR RightColourStep = (Colour[3] - Colour[1]) * InvNumPolysY;
+
+	XMVECTOR LeftPos = Pos[0];
+	XMVECTOR LeftColour = Colour[0];
+	XMVECTOR RightPos = Pos[1];
+	XMVECTOR RightColour = Colour[1];
+
+	cSoAVertices Verts;
+
+	for (int y = 0; y <= NumPolysY; y++)
+	{
+		// Put the last row exactly on the far edge rather than relying on the
+		// accumulated differences.
+		if (y == NumPolysY)
+		{
+			LeftPos = Pos[2];
+			LeftColour = Colour[2];
+			RightPos = Pos[3];
+			RightColour = Colour[3];
+		}
+
+		// Forward differences along the row, four vertices at a time. The padding at
+		// the end of the row gets filled too, which keeps it finite.
+		Verts.Init(LeftPos, LeftColour,
+			(RightPos - LeftPos) * InvNumPolysX,
+			(RightColour - LeftColour) * InvNumPolysX);
+
+		for (int x = 0; x < RowStride; x += 4)
+		{
+			Verts.Store(Grid, x, y);
+			Verts.Advance();
+		}
+
+		// As with the rows, the last vertex goes exactly on the edge.
+		Grid.SetVert(NumPolysX, y, cQuadVertex(RightPos, RightColour));
+
+		LeftPos += LeftPosStep;
+		LeftColour += LeftColourStep;
+		RightPos += RightPosStep;
+		RightColour += RightColourStep;
+	}
+}
+
+}
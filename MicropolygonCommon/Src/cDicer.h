@@ -0,0 +1,26 @@
+#pragma once
+
+namespace MicropolygonCommon
+{
+
+// Forward decls.
+class cQuad;
+class cGrid;
+
+//--------------------------------------------------------------------------------------
+// Dices quads into grids of micropolygon vertices.
+//
+// Vertices are generated four at a time in structure-of-arrays form using forward
+// differences, so each new vertex costs an add per channel rather than a pair of lerps.
+// Colours stay in float until the final store, where they are packed once.
+//--------------------------------------------------------------------------------------
+class cDicer
+{
+public:
+
+	// Fill in every vertex of Grid from the bilinear patch defined by Quad.
+	// The grid must already have been created with the desired dice rates.
+	static void Dice(const cQuad& Quad, cGrid& Grid);
+};
+
+}
@@ -1,44 +1,83 @@
 #pragma once
 
 #include "cQuad.h"
+#include "cLinearArena.h"
 
 namespace MicropolygonCommon
 {
 
 //--------------------------------------------------------------------------------------
 // A grid of micropolygons.
+//
+// Vertices are stored as separate arrays of x, y and z positions and colours, one row
+// after another. Each row is padded to a multiple of GridRowAlignment vertices and
+// starts on a GridRowAlignment * 4 byte boundary, so whole rows can be processed with
+// aligned SIMD loads and stores without special cases at the end. The padding holds
+// whatever the dicer puts there, which is finite but otherwise meaningless.
 //--------------------------------------------------------------------------------------
+const int GridRowAlignment = 8;
+
 class cGrid
 {
 public:
 
-	cGrid(int NumPolysX, int NumPolysY, const XMFLOAT4X4& Transform, const XMFLOAT4X4& PrevTransform)
+	// The vertices are allocated from Arena, so the grid must not outlive the
+	// arena's next reset.
+	cGrid(int NumPolysX, int NumPolysY, const XMFLOAT4X4& Transform, const XMFLOAT4X4& PrevTransform, cLinearArena& Arena)
 		: m_NumPolysX(NumPolysX)
 		, m_NumPolysY(NumPolysY)
+		, m_RowStride((NumPolysX + GridRowAlignment) & ~(GridRowAlignment - 1))
 		, m_Transform(Transform)
 		, m_PrevTransform(PrevTransform)
-		, m_Verts(new cQuadVertex[(NumPolysX + 1) * (NumPolysY + 1)])
-	{}
-
-	~cGrid()
 	{
-		delete[] m_Verts;
+		const size_t NumVerts = m_RowStride * (NumPolysY + 1);
+		for (int c = 0; c < 3; c++)
+		{
+			m_Pos[c] = static_cast<float*>(Arena.Alloc(NumVerts * sizeof(float), GridRowAlignment * sizeof(float)));
+		}
+		m_Colours = static_cast<XMUSHORTN4*>(Arena.Alloc(NumVerts * sizeof(XMUSHORTN4), GridRowAlignment * sizeof(float)));
 	}
 
-	const cQuadVertex& GetVert(int x, int y) const
+	cQuadVertex GetVert(int x, int y) const
 	{
-		_ASSERTE(x >= 0 && x <= m_NumPolysX);
-		_ASSERTE(y >= 0 && y <= m_NumPolysY);
-		return m_Verts[y * (m_NumPolysX + 1) + x];
+		const int i = GetIndex(x, y);
+		return cQuadVertex(XMFLOAT3(m_Pos[0][i], m_Pos[1][i], m_Pos[2][i]), m_Colours[i]);
 	}
 
 	void SetVert(int x, int y, const cQuadVertex& Vert)
 	{
-		_ASSERTE(x >= 0 && x <= m_NumPolysX);
-		_ASSERTE(y >= 0 && y <= m_NumPolysY);
-		m_Verts[y * (m_NumPolysX + 1) + x] = Vert;
+		const int i = GetIndex(x, y);
+		m_Pos[0][i] = Vert.pos.x;
+		m_Pos[1][i] = Vert.pos.y;
+		m_Pos[2][i] = Vert.pos.z;
+		m_Colours[i] = Vert.colour;
 	}
 
+	XMVECTOR GetPos(int x, int y) const
+	{
+		const int i = GetIndex(x, y);
+		return XMVectorSet(m_Pos[0][i], m_Pos[1][i], m_Pos[2][i], 1.0f);
+	}
+
+	const XMUSHORTN4& GetColour(int x, int y) const
+	{
+		return m_Colours[GetIndex(x, y)];
+	}
+
+	// Rows of vertices, each GetRowStride() long. Row y runs along y = const.
+	const float* GetXRow(int y) const { return GetRow(m_Pos[0], y); }
+	const float* GetYRow(int y) const { return GetRow(m_Pos[1], y); }
+	const float* GetZRow(int y) const { return GetRow(m_Pos[2], y); }
+	const XMUSHORTN4* GetColourRow(int y) const { return GetRow(m_Colours, y); }
+
+	float* GetXRow(int y) { return GetRow(m_Pos[0], y); }
+	float* GetYRow(int y) { return GetRow(m_Pos[1], y); }
+	float* GetZRow(int y) { return GetRow(m_Pos[2], y); }
+	XMUSHORTN4* GetColourRow(int y) { return GetRow(m_Colours, y); }
+
+	// Number of vertices from the start of one row to the next, padding included.
+	int GetRowStride() const { return m_RowStride; }
+
 	int GetNumPolysX() const { return m_NumPolysX; }
 	int GetNumPolysY() const { return m_NumPolysY; }
 
@@ -47,9 +86,27 @@ public:
 
 private:
 
+	int GetIndex(int x, int y) const
+	{
+		_ASSERTE(x >= 0 && x <= m_NumPolysX);
+		_ASSERTE(y >= 0 && y <= m_NumPolysY);
+		return y * m_RowStride + x;
+	}
+
+	template <typename T>
+	T* GetRow(T* Array, int y) const
+	{
+		_ASSERTE(y >= 0 && y <= m_NumPolysY);
+		return Array + y * m_RowStride;
+	}
+
 	int				m_NumPolysX;
 	int				m_NumPolysY;
-	cQuadVertex*	m_Verts;
+	int				m_RowStride;
+
+	// Vertex positions (x, y and z arrays) and colours.
+	float*			m_Pos[3];
+	XMUSHORTN4*		m_Colours;
 
 	// Transforms for the current and previous frames.
 	XMFLOAT4X4	m_Transform;
@@ -0,0 +1,200 @@
+//--------------------------------------------------------------------------------------
+// Linear arena implementation.
+//--------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "cLinearArena.h"
+#include "cTaskScheduler.h"
+#include "Utility.h"
+#include "Maths.h"
+
+using namespace std;
+
+namespace MicropolygonCommon
+{
+
+namespace
+{
+
+// Smallest block to allocate. Bigger allocations get a block to themselves.
+const size_t MinBlockSize = 1024 * 1024;
+
+}
+
+//--------------------------------------------------------------------------------------
+// cLinearArena implementation.
+//--------------------------------------------------------------------------------------
+
+cLinearArena::cLinearArena()
+	: m_CurrentBlock(0)
+	, m_Offset(0)
+{
+}
+
+cLinearArena::~cLinearArena()
+{
+	for (size_t i = 0; i < m_Blocks.size(); i++)
+	{
+		AlignedFree(m_Blocks[i].m_Memory);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Allocate uninitialised memory.
+//--------------------------------------------------------------------------------------
+void* cLinearArena::Alloc(size_t Size, size_t Alignment)
+{
+	_ASSERTE(Alignment > 0 && (Alignment & (Alignment - 1)) == 0);
+
+	for (;;)
+	{
+		if (m_CurrentBlock < m_Blocks.size())
+		{
+			const cBlock& Block = m_Blocks[m_CurrentBlock];
+
+			// Align the address rather than the offset, as blocks are only pointer aligned.
+			const uintptr_t Base = (uintptr_t) Block.m_Memory;
+			const uintptr_t Start = (Base + m_Offset + Alignment - 1) & ~(uintptr_t) (Alignment - 1);
+			if (Start + Size <= Base + Block.m_Size)
+			{
+				m_Offset = Start + Size - Base;
+				return (void*) Start;
+			}
+
+			// Doesn't fit, so move on to the next block.
+			m_CurrentBlock++;
+			m_Offset = 0;
+		}
+
+		// Make sure the next block is big enough.
+		if (m_CurrentBlock >= m_Blocks.size() || m_Blocks[m_CurrentBlock].m_Size < Size + Alignment)
+		{
+			AddBlock(Size + Alignment);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Start a new block of at least Size bytes at the current position.
+//--------------------------------------------------------------------------------------
+void cLinearArena::AddBlock(size_t Size)
+{
+	cBlock Block;
+	Block.m_Size = Max(Size, MinBlockSize);
+	Block.m_Memory = AlignedAlloc<BYTE>(Block.m_Size);
+
+	m_Blocks.insert(m_Blocks.begin() + m_CurrentBlock, Block);
+	m_Offset = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Free everything.
+//--------------------------------------------------------------------------------------
+void cLinearArena::Reset()
+{
+	// Replace several blocks with one that holds them all, so a steady workload ends
+	// up in a single block.
+	if (m_Blocks.size() > 1)
+	{
+		size_t TotalSize = 0;
+		for (size_t i = 0; i < m_Blocks.size(); i++)
+		{
+			TotalSize += m_Blocks[i].m_Size;
+			AlignedFree(m_Blocks[i].m_Memory);
+		}
+		m_Blocks.clear();
+
+		m_CurrentBlock = 0;
+		AddBlock(TotalSize);
+	}
+
+	m_CurrentBlock = 0;
+	m_Offset = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Markers for freeing recent allocations.
+//--------------------------------------------------------------------------------------
+cLinearArena::cMarker cLinearArena::GetMarker() const
+{
+	cMarker Marker;
+	Marker.m_Block = m_CurrentBlock;
+	Marker.m_Offset = m_Offset;
+	return Marker;
+}
+
+void cLinearArena::Rewind(const cMarker& Marker)
+{
+	_ASSERTE(Marker.m_Block < m_CurrentBlock ||
+		(Marker.m_Block == m_CurrentBlock && Marker.m_Offset <= m_Offset));
+
+	m_CurrentBlock = Marker.m_Block;
+	m_Offset = Marker.m_Offset;
+}
+
+//--------------------------------------------------------------------------------------
+// cFrameArenas implementation.
+//--------------------------------------------------------------------------------------
+
+cFrameArenas::cFrameArenas()
+{
+	Reset();
+}
+
+cFrameArenas::~cFrameArenas()
+{
+	for (size_t i = 0; i < m_Arenas.size(); i++)
+	{
+		delete m_Arenas[i];
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Get the calling thread's arena.
+//--------------------------------------------------------------------------------------
+cLinearArena& cFrameArenas::GetThreadArena()
+{
+	const int ThreadIndex = cTaskScheduler::GetThreadIndex();
+	_ASSERTE(ThreadIndex < (int) m_Arenas.size());
+	return *m_Arenas[ThreadIndex];
+}
+
+//--------------------------------------------------------------------------------------
+// Mark where every arena is up to, and free everything allocated since.
+//--------------------------------------------------------------------------------------
+void cFrameArenas::GetMarkers(tMarkers& Markers) const
+{
+	Markers.resize(m_Arenas.size());
+	for (size_t i = 0; i < m_Arenas.size(); i++)
+	{
+		Markers[i] = m_Arenas[i]->GetMarker();
+	}
+}
+
+void cFrameArenas::Rewind(const tMarkers& Markers)
+{
+	_ASSERTE(Markers.size() == m_Arenas.size());
+	for (size_t i = 0; i < m_Arenas.size(); i++)
+	{
+		m_Arenas[i]->Rewind(Markers[i]);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Free everything in every arena, and match the arenas to the scheduler's threads.
+//--------------------------------------------------------------------------------------
+void cFrameArenas::Reset()
+{
+	const size_t NumThreads = (size_t) cTaskScheduler::Instance().GetNumThreads();
+	while (m_Arenas.size() < NumThreads)
+	{
+		m_Arenas.push_back(new cLinearArena);
+	}
+
+	for (size_t i = 0; i < m_Arenas.size(); i++)
+	{
+		m_Arenas[i]->Reset();
+	}
+}
+
+}
@@ -0,0 +1,141 @@
+//--------------------------------------------------------------------------------------
+// cLinearArena.h -- Linear (bump pointer) allocators for per-frame data.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+namespace MicropolygonCommon
+{
+
+//--------------------------------------------------------------------------------------
+// Hands out memory by bumping a pointer through large blocks. Nothing is freed
+// individually: the arena is either reset as a whole or rewound to an earlier marker,
+// freeing everything allocated since. Not thread safe.
+//--------------------------------------------------------------------------------------
+class cLinearArena
+{
+public:
+
+	// A position in the arena to rewind to.
+	class cMarker
+	{
+	public:
+		size_t	m_Block;
+		size_t	m_Offset;
+	};
+
+	cLinearArena();
+	~cLinearArena();
+
+	// Allocate uninitialised memory.
+	void* Alloc(size_t Size, size_t Alignment);
+
+	// Allocate an uninitialised array. No constructors are run.
+	template <typename T>
+	T* Alloc(size_t Count)
+	{
+		return static_cast<T*>(Alloc(Count * sizeof(T), alignof(T)));
+	}
+
+	// Free everything. Keeps the memory for reuse, merged into a single block if the
+	// last use spilled over several.
+	void Reset();
+
+	// Free everything allocated since the marker was taken.
+	cMarker GetMarker() const;
+	void Rewind(const cMarker& Marker);
+
+private:
+
+	// Hide copy constructor.
+	cLinearArena(const cLinearArena&);
+
+	// Start a new block of at least Size bytes after the current one.
+	void AddBlock(size_t Size);
+
+	class cBlock
+	{
+	public:
+		BYTE*	m_Memory;
+		size_t	m_Size;
+	};
+
+	std::vector<cBlock>	m_Blocks;
+	size_t				m_CurrentBlock;
+	size_t				m_Offset;		// Into the current block.
+};
+
+//--------------------------------------------------------------------------------------
+// Rewinds an arena to where it was when the scope started. For temporary buffers.
+//--------------------------------------------------------------------------------------
+class cArenaScope
+{
+public:
+
+	cArenaScope(cLinearArena& Arena)
+		: m_Arena(Arena)
+		, m_Marker(Arena.GetMarker())
+	{}
+
+	~cArenaScope()
+	{
+		m_Arena.Rewind(m_Marker);
+	}
+
+private:
+
+	cArenaScope& operator=(const cArenaScope&);
+
+	cLinearArena&			m_Arena;
+	cLinearArena::cMarker	m_Marker;
+};
+
+//--------------------------------------------------------------------------------------
+// One arena per scheduler thread for data that lives for a frame, such as grids.
+// Reset at the start of each frame. Singleton.
+//
+// Temporary allocations can also be made with a cArenaScope, as long as nothing that
+// has to outlive the scope is allocated on the same thread while it's open.
+//
+// The arenas are shared by every renderer and rasterizer, and threads outside the
+// scheduler's pool all use the first one (see cTaskScheduler::GetThreadIndex), so only
+// one thread may be rendering at a time. Several rasterizers can exist, but frames
+// must not be rendered with them concurrently.
+//--------------------------------------------------------------------------------------
+class cFrameArenas
+{
+public:
+
+	// Get the calling thread's arena.
+	cLinearArena& GetThreadArena();
+
+	// Free everything in every arena. Must not be called while tasks are running.
+	void Reset();
+
+	// Mark where every arena is up to, then free everything allocated since. For data
+	// that doesn't last the whole frame. Rewind must not be called while tasks are
+	// running.
+	typedef std::vector<cLinearArena::cMarker> tMarkers;
+	void GetMarkers(tMarkers& Markers) const;
+	void Rewind(const tMarkers& Markers);
+
+	// Get the singleton instance.
+	static cFrameArenas& Instance()
+	{
+		static cFrameArenas instance;
+		return instance;
+	}
+
+private:
+
+	// Hide constructors.
+	cFrameArenas();
+	cFrameArenas(const cFrameArenas&);
+	~cFrameArenas();
+
+	std::vector<cLinearArena*>	m_Arenas;
+};
+
+}
@@ -4,59 +4,471 @@
 #include "cScene.h"
 #include "iRasterizer.h"
 #include "cGrid.h"
+#include "cDicer.h"
+#include "cTaskScheduler.h"
+#include "cLinearArena.h"
+#include <atomic>
+#include <new>
 
 using namespace std;
 
 namespace MicropolygonCommon
 {
 
+namespace
+{
+
+// Corners with a clip-space w at or below this are treated as being behind the eye.
+const float MinClipW = 1.0e-5f;
+
+// Number of frames being rendered, to catch renders overlapping (see cFrameArenas).
+atomic<int> g_NumRendering(0);
+
+// Bits for the planes through the eye that bound the view, set for a clip-space
+// position on the outside of each.
+enum eOutside
+{
+	Outside_Left	= 1,
+	Outside_Right	= 2,
+	Outside_Bottom	= 4,
+	Outside_Top		= 8,
+	Outside_Behind	= 16,
+};
+
+//--------------------------------------------------------------------------------------
+// Project the corners of a quad to normalised screen space. Returns the number of
+// corners on or behind the eye plane; the projections are meaningless unless it's 0.
+// Clears the bits in Outside for any plane a corner is inside. The planes are tested
+// in clip space, so this works whichever side of the eye the corners are.
+//--------------------------------------------------------------------------------------
+int ProjectCorners(const cQuad& Quad, CXMMATRIX Transform, XMVECTOR* Positions, int& Outside)
+{
+	int NumBehind = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		const XMVECTOR Clip = XMVector3Transform(Quad.m_Verts[i].GetPos(), Transform);
+		const float x = XMVectorGetX(Clip);
+		const float y = XMVectorGetY(Clip);
+		const float w = XMVectorGetW(Clip);
+
+		int Corner = 0;
+		Corner |= x < -w ? Outside_Left : 0;
+		Corner |= x > w ? Outside_Right : 0;
+		Corner |= y < -w ? Outside_Bottom : 0;
+		Corner |= y > w ? Outside_Top : 0;
+		Corner |= w <= MinClipW ? Outside_Behind : 0;
+		Outside &= Corner;
+
+		if (w <= MinClipW)
+		{
+			NumBehind++;
+			continue;
+		}
+		Positions[i] = Clip / w;
+	}
+	return NumBehind;
+}
+
+//--------------------------------------------------------------------------------------
+// Length in pixels of the edge between two projected corners.
+//--------------------------------------------------------------------------------------
+float PixelEdgeLength(FXMVECTOR a, FXMVECTOR b, FXMVECTOR HalfScreenSize)
+{
+	return XMVectorGetX(XMVector2Length((b - a) * HalfScreenSize));
+}
+
+//--------------------------------------------------------------------------------------
+// Per-frame parameters needed to bound quads.
+//--------------------------------------------------------------------------------------
+class cFrameParams
+{
+public:
+
+	cFrameParams(const cScene& Scene, int ScreenWidth, int ScreenHeight, float MicropolygonSize)
+		: m_Transform(XMLoadFloat4x4(&Scene.m_Transform))
+		, m_PrevTransform(XMLoadFloat4x4(&Scene.m_PrevTransform))
+		, m_HalfScreenSize(XMVectorSet(0.5f * ScreenWidth, 0.5f * ScreenHeight, 0.0f, 0.0f))
+		, m_MicropolygonSize(MicropolygonSize)
+	{}
+
+	XMMATRIX	m_Transform;
+	XMMATRIX	m_PrevTransform;
+	XMVECTOR	m_HalfScreenSize;
+	float		m_MicropolygonSize;
+};
+
+//--------------------------------------------------------------------------------------
+// The result of bounding a quad.
+//--------------------------------------------------------------------------------------
+class cQuadBound
+{
+public:
+
+	// How finely to dice the quad.
+	int		m_NumPolysX;
+	int		m_NumPolysY;
+
+	// Pixel-space bound over the whole frame. Only valid if m_bProjected is set,
+	// which it isn't for quads crossing the eye plane.
+	bool	m_bProjected;
+	float	m_PixelXMin, m_PixelYMin, m_PixelXMax, m_PixelYMax;
+};
+
+//--------------------------------------------------------------------------------------
+// Bound a quad over the frame and work out how finely to dice it.
+//
+// The corners are projected with both the current and previous transforms. The quad
+// is culled if it is off screen, or behind the eye, for the whole frame, otherwise
+// each axis is diced according to the longest projected edge along it at either end
+// of the frame. Returns false if the quad should be skipped.
+//--------------------------------------------------------------------------------------
+bool BoundQuad(const cQuad& Quad, const cFrameParams& Params, cQuadBound& Bound)
+{
+	XMVECTOR Positions[8];
+	float LengthX;
+	float LengthY;
+
+	int Outside = ~0;
+	const int NumBehind =
+		ProjectCorners(Quad, Params.m_Transform, Positions, Outside) +
+		ProjectCorners(Quad, Params.m_PrevTransform, Positions + 4, Outside);
+
+	// Every corner is outside the same plane at both ends of the frame, so none of it
+	// can be seen. This also catches quads crossing the eye plane that are off to one
+	// side, and quads wholly behind the eye, which projecting would mirror onto the
+	// screen.
+	if (Outside)
+	{
+		return false;
+	}
+
+	Bound.m_bProjected = NumBehind == 0;
+
+	if (Bound.m_bProjected)
+	{
+		// The grid (and any motion between the frames) stays inside the hull of the
+		// projected corners, so the quad can go if their bound is off screen.
+		XMVECTOR BoundMin = Positions[0];
+		XMVECTOR BoundMax = Positions[0];
+		for (int i = 1; i < 8; i++)
+		{
+			BoundMin = XMVectorMin(BoundMin, Positions[i]);
+			BoundMax = XMVectorMax(BoundMax, Positions[i]);
+		}
+
+		if (XMVectorGetX(BoundMax) < -1.0f || XMVectorGetX(BoundMin) > 1.0f ||
+			XMVectorGetY(BoundMax) < -1.0f || XMVectorGetY(BoundMin) > 1.0f)
+		{
+			return false;
+		}
+
+		// Convert to pixels (y is flipped).
+		const float HalfWidth = XMVectorGetX(Params.m_HalfScreenSize);
+		const float HalfHeight = XMVectorGetY(Params.m_HalfScreenSize);
+		Bound.m_PixelXMin = (XMVectorGetX(BoundMin) + 1.0f) * HalfWidth;
+		Bound.m_PixelXMax = (XMVectorGetX(BoundMax) + 1.0f) * HalfWidth;
+		Bound.m_PixelYMin = (1.0f - XMVectorGetY(BoundMax)) * HalfHeight;
+		Bound.m_PixelYMax = (1.0f - XMVectorGetY(BoundMin)) * HalfHeight;
+
+		// Verts 0-1 and 2-3 run along the grid's x axis, 0-2 and 1-3 along its y axis.
+		LengthX = 0.0f;
+		LengthY = 0.0f;
+		for (int Frame = 0; Frame < 2; Frame++)
+		{
+			const XMVECTOR* p = Positions + Frame * 4;
+			LengthX = Max(LengthX, Max(PixelEdgeLength(p[0], p[1], Params.m_HalfScreenSize), PixelEdgeLength(p[2], p[3], Params.m_HalfScreenSize)));
+			LengthY = Max(LengthY, Max(PixelEdgeLength(p[0], p[2], Params.m_HalfScreenSize), PixelEdgeLength(p[1], p[3], Params.m_HalfScreenSize)));
+		}
+	}
+	else
+	{
+		// Crosses the eye plane, so there's no sensible projected size. Dice as if it
+		// covered the whole screen; SplitToFit keeps this to small pieces.
+		LengthX = LengthY = 2.0f * Max(XMVectorGetX(Params.m_HalfScreenSize), XMVectorGetY(Params.m_HalfScreenSize));
+	}
+
+	Bound.m_NumPolysX = (int) ceil(LengthX / Params.m_MicropolygonSize);
+	Bound.m_NumPolysY = (int) ceil(LengthY / Params.m_MicropolygonSize);
+
+	return Bound.m_NumPolysX * Bound.m_NumPolysY > 0;
+}
+
+//--------------------------------------------------------------------------------------
+// A quad, or a piece of one, ready for dicing.
+//--------------------------------------------------------------------------------------
+class cBoundedQuad
+{
+public:
+
+	cBoundedQuad(const cQuad& Quad, const cQuadBound& Bound)
+		: m_Quad(Quad)
+		, m_Bound(Bound)
+	{}
+
+	cQuad		m_Quad;
+	cQuadBound	m_Bound;
+};
+
+// Number of grids diced at once. Bounds the memory held by diced grids.
+const int DiceBatchSize = 64;
+
+//--------------------------------------------------------------------------------------
+// Dice bounded quads and send them to the rasterizer. Each batch of quads is diced in
+// parallel, then the grids are rasterized in order and freed.
+//--------------------------------------------------------------------------------------
+void RenderQuads(const vector<const cBoundedQuad*>& Quads, const cScene& Scene, iRasterizer* Rasterizer)
+{
+	cGrid* Grids[DiceBatchSize];
+	cFrameArenas::tMarkers Markers;
+
+	for (int BatchStart = 0; BatchStart < (int) Quads.size(); BatchStart += DiceBatchSize)
+	{
+		const int BatchSize = Min(DiceBatchSize, (int) Quads.size() - BatchStart);
+		cFrameArenas::Instance().GetMarkers(Markers);
+
+		cTaskScheduler::Instance().ParallelFor(BatchSize, 1, [&](int Begin, int End)
+		{
+			for (int i = Begin; i < End; i++)
+			{
+				const cBoundedQuad& Quad = *Quads[BatchStart + i];
+
+				// Create a new uPoly grid for this quad. It lives until the batch is rasterized.
+				cLinearArena& Arena = cFrameArenas::Instance().GetThreadArena();
+				Grids[i] = new (Arena.Alloc<cGrid>(1)) cGrid(Quad.m_Bound.m_NumPolysX, Quad.m_Bound.m_NumPolysY,
+					Scene.m_Transform, Scene.m_PrevTransform, Arena);
+
+				// Dice the quad into micropolygons.
+				cDicer::Dice(Quad.m_Quad, *Grids[i]);
+			}
+		});
+
+		for (int i = 0; i < BatchSize; i++)
+		{
+			Rasterizer->RasterizeGrid(*Grids[i]);
+		}
+
+		// Nothing is running on the other threads now, so the whole batch can go.
+		cFrameArenas::Instance().Rewind(Markers);
+	}
+}
+
+// Limit on how many times a quad is halved to fit a size. Pieces can stay large
+// regardless, e.g. when motion blur stretches their bound.
+const int MaxSplitDepth = 16;
+
+//--------------------------------------------------------------------------------------
+// Split a quad in half until each piece's bound fits within MaxSize pixels square, or
+// if bOnScreenFits is set, lies wholly on screen. Pieces that end up off screen are
+// culled, so the rest only need dicing for the part of the screen (or the few
+// buckets) they actually touch.
+//
+// Quads crossing the eye plane have no bound, so are split as far as allowed. The
+// pieces in front of the eye then get their own projected dice rates, and those
+// behind it or off to the side are culled, leaving only small pieces that still cross
+// the plane to be diced at the whole-screen rate.
+//--------------------------------------------------------------------------------------
+void SplitToFit(const cQuad& Quad, const cQuadBound& Bound, const cFrameParams& Params,
+				int MaxSize, bool bOnScreenFits, int Depth, vector<cBoundedQuad>& Pieces)
+{
+	const bool bSmall =
+		Bound.m_PixelXMax - Bound.m_PixelXMin <= MaxSize &&
+		Bound.m_PixelYMax - Bound.m_PixelYMin <= MaxSize;
+	const bool bOnScreen =
+		Bound.m_PixelXMin >= 0.0f && Bound.m_PixelXMax <= 2.0f * XMVectorGetX(Params.m_HalfScreenSize) &&
+		Bound.m_PixelYMin >= 0.0f && Bound.m_PixelYMax <= 2.0f * XMVectorGetY(Params.m_HalfScreenSize);
+	const bool bFits = Bound.m_bProjected && (bSmall || (bOnScreenFits && bOnScreen));
+
+	if (bFits || Depth >= MaxSplitDepth || (Bound.m_NumPolysX <= 1 && Bound.m_NumPolysY <= 1))
+	{
+		Pieces.push_back(cBoundedQuad(Quad, Bound));
+		return;
+	}
+
+	// Split the quad's parametric space in half along its longer axis. The halves
+	// are the same bilinear patch, so the split edge is straight and won't crack.
+	const cQuadVertex* v = Quad.m_Verts;
+	bool bSplitX = Bound.m_NumPolysX >= Bound.m_NumPolysY;
+	if (!Bound.m_bProjected)
+	{
+		// Both axes have the whole-screen rate, so go by the lengths in the scene.
+		const XMVECTOR LengthX = XMVector3Length(v[1].GetPos() - v[0].GetPos()) + XMVector3Length(v[3].GetPos() - v[2].GetPos());
+		const XMVECTOR LengthY = XMVector3Length(v[2].GetPos() - v[0].GetPos()) + XMVector3Length(v[3].GetPos() - v[1].GetPos());
+		bSplitX = XMVectorGetX(LengthX) >= XMVectorGetX(LengthY);
+	}
+
+	cQuad Halves[2];
+	if (bSplitX)
+	{
+		const cQuadVertex Top = Lerp(v[0], v[1], 0.5f);
+		const cQuadVertex Bottom = Lerp(v[2], v[3], 0.5f);
+		Halves[0] = cQuad(v[0], Top, v[2], Bottom);
+		Halves[1] = cQuad(Top, v[1], Bottom, v[3]);
+	}
+	else
+	{
+		const cQuadVertex Left = Lerp(v[0], v[2], 0.5f);
+		const cQuadVertex Right = Lerp(v[1], v[3], 0.5f);
+		Halves[0] = cQuad(v[0], v[1], Left, Right);
+		Halves[1] = cQuad(Left, Right, v[2], v[3]);
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		cQuadBound HalfBound;
+		if (BoundQuad(Halves[i], Params, HalfBound))
+		{
+			SplitToFit(Halves[i], HalfBound, Params, MaxSize, bOnScreenFits, Depth + 1, Pieces);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Convert a pixel coordinate to a bucket index, clamped to the valid range.
+//--------------------------------------------------------------------------------------
+int PixelToBucket(float Pixel, int BucketSize, int NumBuckets)
+{
+	return (int) Clamp(floor(Pixel / (float) BucketSize), 0.0f, (float) (NumBuckets - 1));
+}
+
+}
+
 //--------------------------------------------------------------------------------------
 // Render the scene with the given rasterizer.
 //--------------------------------------------------------------------------------------
 void cSceneRenderer::Render(iRasterizer* Rasterizer, int ScreenWidth, int ScreenHeight)
 {
-	// Process each quad individually.
+	// The frame arenas are shared, so only one frame can be in flight.
+	g_NumRendering++;
+	_ASSERTE(g_NumRendering == 1);
+
+	// Start with empty arenas, merging any blocks the last frame spilled over into.
+	cFrameArenas::Instance().Reset();
+
+	Rasterizer->BeginFrame();
+
+	if (m_BucketSize > 0 && Rasterizer->SupportsBuckets())
+	{
+		RenderBuckets(Rasterizer, ScreenWidth, ScreenHeight);
+	}
+	else
+	{
+		RenderScreen(Rasterizer, ScreenWidth, ScreenHeight);
+	}
+
+	Rasterizer->EndFrame();
+
+	_ASSERTE(g_NumRendering == 1);
+	g_NumRendering--;
+}
+
+//--------------------------------------------------------------------------------------
+// Render the scene over the whole screen in one go.
+//--------------------------------------------------------------------------------------
+void cSceneRenderer::RenderScreen(iRasterizer* Rasterizer, int ScreenWidth, int ScreenHeight)
+{
+	const cFrameParams Params(*m_Scene, ScreenWidth, ScreenHeight, m_MicropolygonSize);
+
+	// Calc screen-space bound and dice rates for each quad. A quad reaching off screen
+	// would be diced at a rate for its whole projected size, so it's split until the
+	// pieces either lie on screen or are no more than a quarter of the screen's size,
+	// and the pieces off screen are dropped.
+	const int MaxPieceSize = Max(ScreenWidth, ScreenHeight) / 4;
+	vector<cBoundedQuad> Quads;
+	for (vector<cQuad>::const_iterator it = m_Scene->m_Quads.begin();
+		it != m_Scene->m_Quads.end(); ++it)
+	{
+		cQuadBound Bound;
+		if (BoundQuad(*it, Params, Bound))
+		{
+			SplitToFit(*it, Bound, Params, MaxPieceSize, true, 0, Quads);
+		}
+	}
+
+	// Dice and rasterize the visible ones.
+	vector<const cBoundedQuad*> QuadPtrs(Quads.size());
+	for (size_t i = 0; i < Quads.size(); i++)
+	{
+		QuadPtrs[i] = &Quads[i];
+	}
+	RenderQuads(QuadPtrs, *m_Scene, Rasterizer);
+}
+
+//--------------------------------------------------------------------------------------
+// Render the scene one screen bucket at a time, Reyes style.
+//--------------------------------------------------------------------------------------
+void cSceneRenderer::RenderBuckets(iRasterizer* Rasterizer, int ScreenWidth, int ScreenHeight)
+{
+	const cFrameParams Params(*m_Scene, ScreenWidth, ScreenHeight, m_MicropolygonSize);
+
+	// Bound all the quads, splitting any that are bigger than a bucket.
+	vector<cBoundedQuad> Pieces;
 	for (vector<cQuad>::const_iterator it = m_Scene->m_Quads.begin();
 		it != m_Scene->m_Quads.end(); ++it)
 	{
-		// Calc screen-space size of the quad.
-		cAABB aabb = it->GetAABB();
-		const float Width = XMVectorGetX(aabb.GetDiagonal());
-		const float Height = XMVectorGetY(aabb.GetDiagonal());
+		cQuadBound Bound;
+		if (BoundQuad(*it, Params, Bound))
+		{
+			SplitToFit(*it, Bound, Params, m_BucketSize, false, 0, Pieces);
+		}
+	}
+
+	// Sort the pieces into every bucket they overlap, allowing for the pixels around
+	// each bucket that the rasterizer needs. The extra pixel covers rounding.
+	const int NumBucketsX = (ScreenWidth + m_BucketSize - 1) / m_BucketSize;
+	const int NumBucketsY = (ScreenHeight + m_BucketSize - 1) / m_BucketSize;
+	const float Margin = (float) Rasterizer->GetBucketMargin() + 1.0f;
+
+	vector< vector<int> > Buckets(NumBucketsX * NumBucketsY);
+	for (int i = 0; i < (int) Pieces.size(); i++)
+	{
+		const cQuadBound& Bound = Pieces[i].m_Bound;
 
-		const float PixelWidth = Width * 0.5f * ScreenWidth;
-		const float PixelHeight = Height * 0.5f * ScreenHeight;
+		// Pieces without a projected bound go everywhere.
+		int BucketXMin = 0;
+		int BucketYMin = 0;
+		int BucketXMax = NumBucketsX - 1;
+		int BucketYMax = NumBucketsY - 1;
 
-		const int NumPolysX = (int) ceil(PixelWidth / m_MicropolygonSize);
-		const int NumPolysY = (int) ceil(PixelHeight / m_MicropolygonSize);
+		if (Bound.m_bProjected)
+		{
+			BucketXMin = PixelToBucket(Bound.m_PixelXMin - Margin, m_BucketSize, NumBucketsX);
+			BucketYMin = PixelToBucket(Bound.m_PixelYMin - Margin, m_BucketSize, NumBucketsY);
+			BucketXMax = PixelToBucket(Bound.m_PixelXMax + Margin, m_BucketSize, NumBucketsX);
+			BucketYMax = PixelToBucket(Bound.m_PixelYMax + Margin, m_BucketSize, NumBucketsY);
+		}
+
+		for (int by = BucketYMin; by <= BucketYMax; by++)
+		{
+			for (int bx = BucketXMin; bx <= BucketXMax; bx++)
+			{
+				Buckets[by * NumBucketsX + bx].push_back(i);
+			}
+		}
+	}
 
-		if (NumPolysX * NumPolysY > 0)
+	// Dice, rasterize and resolve each bucket in turn.
+	vector<const cBoundedQuad*> BucketPieces;
+	for (int by = 0; by < NumBucketsY; by++)
+	{
+		for (int bx = 0; bx < NumBucketsX; bx++)
 		{
-			// Create a new uPoly grid for this quad.
-			cGrid Grid(NumPolysX, NumPolysY, m_Scene->m_Transform, m_Scene->m_PrevTransform);
+			const int XMin = bx * m_BucketSize;
+			const int YMin = by * m_BucketSize;
+			Rasterizer->BeginBucket(XMin, YMin,
+				Min(XMin + m_BucketSize, ScreenWidth),
+				Min(YMin + m_BucketSize, ScreenHeight));
 
-			// Dice the quad into micropolygons.
-			// TODO: Forward differencing is probably more efficient than lerping.
-			for (int y = 0; y <= NumPolysY; y++)
+			const vector<int>& Bucket = Buckets[by * NumBucketsX + bx];
+			BucketPieces.clear();
+			for (vector<int>::const_iterator it = Bucket.begin(); it != Bucket.end(); ++it)
 			{
-				// Start and end points of this row.
-				const float yAlpha = (float) y / (float) NumPolysY;
-				const cQuadVertex RowStart = Lerp(it->m_Verts[0], it->m_Verts[2], yAlpha);
-				const cQuadVertex RowEnd   = Lerp(it->m_Verts[1], it->m_Verts[3], yAlpha);
-
-				for (int x = 0; x <= NumPolysX; x++)
-				{
-					const float xAlpha = (float) x / (float) NumPolysX;
-					const cQuadVertex Vert = Lerp(RowStart, RowEnd, xAlpha);
-
-					// Add vert to the grid.
-					Grid.SetVert(x, y, Vert);
-				}
+				BucketPieces.push_back(&Pieces[*it]);
 			}
+			RenderQuads(BucketPieces, *m_Scene, Rasterizer);
 
-			Rasterizer->RasterizeGrid(Grid);
+			Rasterizer->EndBucket();
 		}
 	}
 }
 
-}
\ No newline at end of file
+}
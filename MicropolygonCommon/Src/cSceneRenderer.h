@@ -1,6 +1,7 @@
 #pragma once
 
 const float DefaultMicropolygonSize = 8.0f;
+const int DefaultBucketSize = 64;
 
 namespace MicropolygonCommon
 {
@@ -16,15 +17,18 @@ public:
 	cSceneRenderer()
 		: m_Scene(NULL)
 		, m_MicropolygonSize(DefaultMicropolygonSize)
+		, m_BucketSize(0)
 	{}
 
 	// Constructor with a given scene.
 	cSceneRenderer(class cScene* Scene)
 		: m_Scene(Scene)
 		, m_MicropolygonSize(DefaultMicropolygonSize)
+		, m_BucketSize(0)
 	{}
 
-	// Render the scene with the given rasterizer.
+	// Render the scene with the given rasterizer. Frames are allocated from the shared
+	// cFrameArenas, so only one thread may be rendering, with any renderer, at a time.
 	void Render(class iRasterizer* Rasterizer, int ScreenWidth, int ScreenHeight);
 
 	// Micropolygon size accessors.
@@ -34,11 +38,26 @@ public:
 		m_MicropolygonSize = NewSize;
 	}
 
+	// Bucket size accessors. Zero renders the whole screen at once.
+	int GetBucketSize() const { return m_BucketSize; }
+	void SetBucketSize(int NewSize)
+	{
+		m_BucketSize = NewSize;
+	}
+
 private:
+
+	// Render the scene over the whole screen at once, or one bucket at a time.
+	void RenderScreen(class iRasterizer* Rasterizer, int ScreenWidth, int ScreenHeight);
+	void RenderBuckets(class iRasterizer* Rasterizer, int ScreenWidth, int ScreenHeight);
+
 	class cScene* m_Scene;
 
 	// Approximate size of each micropolygon in pixels.
 	float m_MicropolygonSize;
+
+	// Width and height of the screen buckets in pixels, or zero to not use buckets.
+	int m_BucketSize;
 };
 
 }
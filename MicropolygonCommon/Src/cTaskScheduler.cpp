@@ -0,0 +1,333 @@
+//--------------------------------------------------------------------------------------
+// Task scheduler implementation.
+//--------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "cTaskScheduler.h"
+#include "Maths.h"
+
+using namespace std;
+
+namespace MicropolygonCommon
+{
+
+namespace
+{
+
+// Index of the queue the current thread owns. Zero for threads outside the pool.
+thread_local int tl_QueueIndex = 0;
+
+}
+
+//--------------------------------------------------------------------------------------
+// cTaskQueue implementation.
+//--------------------------------------------------------------------------------------
+
+void cTaskScheduler::cTaskQueue::Push(const tTaskPtr& Task)
+{
+	lock_guard<mutex> Lock(m_Mutex);
+	m_Tasks.push_back(Task);
+}
+
+bool cTaskScheduler::cTaskQueue::Pop(tTaskPtr& Task)
+{
+	lock_guard<mutex> Lock(m_Mutex);
+	if (m_Tasks.empty())
+		return false;
+
+	Task = m_Tasks.back();
+	m_Tasks.pop_back();
+	return true;
+}
+
+bool cTaskScheduler::cTaskQueue::Steal(tTaskPtr& Task)
+{
+	lock_guard<mutex> Lock(m_Mutex);
+	if (m_Tasks.empty())
+		return false;
+
+	Task = m_Tasks.front();
+	m_Tasks.pop_front();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Start one thread per hardware thread.
+//--------------------------------------------------------------------------------------
+cTaskScheduler::cTaskScheduler()
+	: m_NumQueues(0)
+	, m_NumQueued(0)
+	, m_bQuit(false)
+{
+	SetNumThreads(0);
+}
+
+cTaskScheduler::~cTaskScheduler()
+{
+	StopThreads();
+}
+
+//--------------------------------------------------------------------------------------
+// Change the number of threads. Zero means one per hardware thread.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::SetNumThreads(int NumThreads)
+{
+	if (NumThreads <= 0)
+	{
+		NumThreads = Max(1, (int) thread::hardware_concurrency());
+	}
+
+	StopThreads();
+	StartThreads(NumThreads);
+}
+
+//--------------------------------------------------------------------------------------
+// Start the workers. The calling thread counts as one of them.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::StartThreads(int NumThreads)
+{
+	m_NumQueues = NumThreads;
+	m_Queues.reset(new cTaskQueue[m_NumQueues]);
+	m_bQuit = false;
+
+	for (int i = 1; i < NumThreads; i++)
+	{
+		m_Threads.push_back(thread(&cTaskScheduler::WorkerMain, this, i));
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Stop and join all the workers.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::StopThreads()
+{
+	{
+		lock_guard<mutex> Lock(m_SleepMutex);
+		m_bQuit = true;
+	}
+	m_WakeCondition.notify_all();
+
+	for (size_t i = 0; i < m_Threads.size(); i++)
+	{
+		m_Threads[i].join();
+	}
+	m_Threads.clear();
+}
+
+//--------------------------------------------------------------------------------------
+// Index of the calling thread.
+//--------------------------------------------------------------------------------------
+int cTaskScheduler::GetThreadIndex()
+{
+	return tl_QueueIndex;
+}
+
+//--------------------------------------------------------------------------------------
+// Create a task to run Func.
+//--------------------------------------------------------------------------------------
+tTaskPtr cTaskScheduler::CreateTask(const function<void ()>& Func, const tTaskPtr& Parent)
+{
+	if (Parent)
+	{
+		Parent->m_NumUnfinished++;
+	}
+
+	return tTaskPtr(new cTask(Func, Parent));
+}
+
+//--------------------------------------------------------------------------------------
+// Don't start Task until Prerequisite has finished.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::AddDependency(const tTaskPtr& Task, const tTaskPtr& Prerequisite)
+{
+	lock_guard<mutex> Lock(Prerequisite->m_Mutex);
+	if (!Prerequisite->m_bFinished)
+	{
+		Task->m_NumBlockers++;
+		Prerequisite->m_Dependents.push_back(Task);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Let a task run once all its dependencies have finished.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::Submit(const tTaskPtr& Task)
+{
+	if (--Task->m_NumBlockers == 0)
+	{
+		Schedule(Task);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Queue a task whose dependencies have all finished.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::Schedule(const tTaskPtr& Task)
+{
+	m_Queues[tl_QueueIndex].Push(Task);
+	m_NumQueued++;
+
+	// Taking the lock means a worker can't miss this between checking for work and
+	// going to sleep.
+	{
+		lock_guard<mutex> Lock(m_SleepMutex);
+	}
+	m_WakeCondition.notify_one();
+}
+
+//--------------------------------------------------------------------------------------
+// Get a task to run, preferring this thread's own queue.
+//--------------------------------------------------------------------------------------
+bool cTaskScheduler::FindTask(tTaskPtr& Task)
+{
+	const int Self = tl_QueueIndex;
+
+	bool bFound = m_Queues[Self].Pop(Task);
+	for (int i = 1; i < m_NumQueues && !bFound; i++)
+	{
+		bFound = m_Queues[(Self + i) % m_NumQueues].Steal(Task);
+	}
+
+	if (bFound)
+	{
+		m_NumQueued--;
+	}
+	return bFound;
+}
+
+//--------------------------------------------------------------------------------------
+// Run a task and mark its own part as finished.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::Run(const tTaskPtr& Task)
+{
+	if (Task->m_Func)
+	{
+		Task->m_Func();
+	}
+
+	Finish(Task);
+}
+
+//--------------------------------------------------------------------------------------
+// Mark one part of a task as finished, releasing dependents once it's all done.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::Finish(const tTaskPtr& Task)
+{
+	if (--Task->m_NumUnfinished > 0)
+	{
+		return;
+	}
+
+	vector<tTaskPtr> Dependents;
+	{
+		lock_guard<mutex> Lock(Task->m_Mutex);
+		Task->m_bFinished = true;
+		Dependents.swap(Task->m_Dependents);
+	}
+
+	for (size_t i = 0; i < Dependents.size(); i++)
+	{
+		Submit(Dependents[i]);
+	}
+
+	if (Task->m_Parent)
+	{
+		Finish(Task->m_Parent);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Wait for a task to finish, running other tasks in the meantime.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::Wait(const tTaskPtr& Task)
+{
+	while (!Task->IsFinished())
+	{
+		tTaskPtr Other;
+		if (FindTask(Other))
+		{
+			Run(Other);
+		}
+		else
+		{
+			// Whatever's left is running elsewhere.
+			this_thread::yield();
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Call Func over Grain-sized sub-ranges of [0, Count) in parallel.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::ParallelFor(int Count, int Grain, const function<void (int, int)>& Func)
+{
+	Grain = Max(Grain, 1);
+
+	// Not worth making tasks for.
+	if (Count <= Grain || m_Threads.empty())
+	{
+		if (Count > 0)
+		{
+			Func(0, Count);
+		}
+		return;
+	}
+
+	// The root only exists to be waited on. Its own part is done here.
+	tTaskPtr Root = CreateTask(function<void ()>());
+	SplitRange(0, Count, Grain, Func, Root);
+	Finish(Root);
+
+	Wait(Root);
+}
+
+//--------------------------------------------------------------------------------------
+// Spawn tasks for the top halves of [Begin, End) until a Grain-sized part is left,
+// then run that. Stolen halves get split further by whoever stole them.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::SplitRange(int Begin, int End, int Grain, const function<void (int, int)>& Func, const tTaskPtr& Parent)
+{
+	while (End - Begin > Grain)
+	{
+		// Split on a multiple of the grain so the ranges are the same however the
+		// work is spread.
+		const int NumGrains = (End - Begin + Grain - 1) / Grain;
+		const int Mid = Begin + (NumGrains / 2) * Grain;
+
+		const function<void (int, int)>* pFunc = &Func;
+		const int UpperEnd = End;
+		tTaskPtr Upper = CreateTask([=]() { SplitRange(Mid, UpperEnd, Grain, *pFunc, Parent); }, Parent);
+		Submit(Upper);
+
+		End = Mid;
+	}
+
+	Func(Begin, End);
+}
+
+//--------------------------------------------------------------------------------------
+// Worker thread entry point. Runs tasks, sleeping when there are none.
+//--------------------------------------------------------------------------------------
+void cTaskScheduler::WorkerMain(int QueueIndex)
+{
+	tl_QueueIndex = QueueIndex;
+
+	for (;;)
+	{
+		tTaskPtr Task;
+		if (FindTask(Task))
+		{
+			Run(Task);
+			continue;
+		}
+
+		unique_lock<mutex> Lock(m_SleepMutex);
+		m_WakeCondition.wait(Lock, [this] { return m_bQuit || m_NumQueued > 0; });
+		if (m_bQuit)
+		{
+			return;
+		}
+	}
+}
+
+}
@@ -0,0 +1,171 @@
+//--------------------------------------------------------------------------------------
+// cTaskScheduler.h -- Work-stealing task scheduler.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MicropolygonCommon
+{
+
+class cTask;
+typedef std::shared_ptr<cTask> tTaskPtr;
+
+//--------------------------------------------------------------------------------------
+// A unit of work for the scheduler. Create with cTaskScheduler::CreateTask.
+//
+// A task counts as finished once its function has run and all of its children have
+// finished. Tasks depending on it only start after that.
+//--------------------------------------------------------------------------------------
+class cTask
+{
+public:
+
+	// Has the task and all of its children finished?
+	bool IsFinished() const { return m_NumUnfinished == 0; }
+
+private:
+
+	friend class cTaskScheduler;
+
+	cTask(const std::function<void ()>& Func, const tTaskPtr& Parent)
+		: m_Func(Func)
+		, m_Parent(Parent)
+		, m_NumUnfinished(1)
+		, m_NumBlockers(1)
+		, m_bFinished(false)
+	{}
+
+	std::function<void ()>	m_Func;
+	tTaskPtr				m_Parent;
+
+	// This task plus its unfinished children.
+	std::atomic<int>		m_NumUnfinished;
+
+	// Unfinished dependencies, plus one until the task is submitted.
+	std::atomic<int>		m_NumBlockers;
+
+	// Tasks waiting for this one, guarded by m_Mutex along with m_bFinished.
+	std::mutex				m_Mutex;
+	std::vector<tTaskPtr>	m_Dependents;
+	bool					m_bFinished;
+};
+
+//--------------------------------------------------------------------------------------
+// Runs tasks on a persistent pool of worker threads. Singleton.
+//
+// Each worker has its own deque of ready tasks: it pushes and pops at the back, so it
+// works depth-first on what it just spawned, while idle workers steal from the front,
+// taking the oldest and usually biggest pieces of work. Threads that aren't workers
+// (e.g. the main thread) share one extra deque. Waiting threads run other tasks rather
+// than blocking, so tasks can safely wait on tasks they spawn.
+//--------------------------------------------------------------------------------------
+class cTaskScheduler
+{
+public:
+
+	// Create a task to run Func. If Parent is given, the parent won't count as
+	// finished until this task has. The task doesn't run until it is submitted.
+	tTaskPtr CreateTask(const std::function<void ()>& Func, const tTaskPtr& Parent = tTaskPtr());
+
+	// Don't start Task until Prerequisite has finished. Must be called before Task
+	// is submitted.
+	void AddDependency(const tTaskPtr& Task, const tTaskPtr& Prerequisite);
+
+	// Let a task run once all its dependencies have finished.
+	void Submit(const tTaskPtr& Task);
+
+	// Wait for a task to finish, running other tasks in the meantime.
+	void Wait(const tTaskPtr& Task);
+
+	// Call Func(Begin, End) over sub-ranges of [0, Count) of at most Grain indices,
+	// in parallel, and wait for them all. The ranges depend only on Count and Grain.
+	void ParallelFor(int Count, int Grain, const std::function<void (int, int)>& Func);
+
+	// Number of threads tasks run on, including the calling thread.
+	int GetNumThreads() const { return (int) m_Threads.size() + 1; }
+
+	// Index of the calling thread, in [0, GetNumThreads()). Threads outside the pool
+	// all get zero.
+	static int GetThreadIndex();
+
+	// Change the number of threads. Zero means one per hardware thread.
+	// Must not be called while tasks are in flight.
+	void SetNumThreads(int NumThreads);
+
+	// Get the singleton instance.
+	static cTaskScheduler& Instance()
+	{
+		static cTaskScheduler instance;
+		return instance;
+	}
+
+private:
+
+	//----------------------------------------------------------------------------------
+	// A deque of tasks that are ready to run.
+	//----------------------------------------------------------------------------------
+	class cTaskQueue
+	{
+	public:
+
+		void Push(const tTaskPtr& Task);
+		bool Pop(tTaskPtr& Task);		// Newest task.
+		bool Steal(tTaskPtr& Task);		// Oldest task.
+
+	private:
+
+		std::mutex				m_Mutex;
+		std::deque<tTaskPtr>	m_Tasks;
+	};
+
+	// Hide constructors.
+	cTaskScheduler();
+	cTaskScheduler(const cTaskScheduler&);
+	~cTaskScheduler();
+
+	void StartThreads(int NumThreads);
+	void StopThreads();
+
+	// Worker thread entry point.
+	void WorkerMain(int QueueIndex);
+
+	// Queue a task whose dependencies have all finished.
+	void Schedule(const tTaskPtr& Task);
+
+	// Get a task to run, from this thread's own queue if possible, otherwise by
+	// stealing one. Returns false if there's nothing to do.
+	bool FindTask(tTaskPtr& Task);
+
+	// Run a task and mark its own part as finished.
+	void Run(const tTaskPtr& Task);
+
+	// Mark one part of a task as finished, releasing dependents once it's all done.
+	void Finish(const tTaskPtr& Task);
+
+	// Spawn tasks for the top parts of [Begin, End) until a Grain-sized part is left,
+	// then run that.
+	void SplitRange(int Begin, int End, int Grain, const std::function<void (int, int)>& Func, const tTaskPtr& Parent);
+
+	std::vector<std::thread>		m_Threads;
+
+	// Queue 0 is shared by all threads outside the pool. The rest belong to workers.
+	std::unique_ptr<cTaskQueue[]>	m_Queues;
+	int								m_NumQueues;
+
+	// For putting idle workers to sleep.
+	std::atomic<int>			m_NumQueued;
+	std::mutex					m_SleepMutex;
+	std::condition_variable		m_WakeCondition;
+	bool						m_bQuit;
+};
+
+}
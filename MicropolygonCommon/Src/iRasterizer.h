@@ -13,6 +13,23 @@ class iRasterizer
 {
 public:
 	virtual void RasterizeGrid(const cGrid& Grid) = 0;
+
+	// Frame boundaries. All the grids (and buckets) for a frame are passed between
+	// BeginFrame and EndFrame, so rasterizers can clear and resolve once per frame
+	// rather than per grid. The frame is complete once EndFrame returns.
+	virtual void BeginFrame() {}
+	virtual void EndFrame() {}
+
+	// Bucketed rendering. Rasterizers that support it only need to cover the
+	// pixel rectangle [XMin,XMax) x [YMin,YMax) with the grids passed between
+	// BeginBucket and EndBucket, and resolve just that rectangle at the end.
+	virtual bool SupportsBuckets() const { return false; }
+	virtual void BeginBucket(int /*XMin*/, int /*YMin*/, int /*XMax*/, int /*YMax*/) {}
+	virtual void EndBucket() {}
+
+	// Number of pixels around a bucket that can still affect its resolved result
+	// (e.g. due to the reconstruction filter), so grids there must be rasterized too.
+	virtual int GetBucketMargin() const { return 0; }
 };
 
 }
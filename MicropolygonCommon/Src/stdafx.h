@@ -1,17 +1,29 @@
 // Disable STL exceptions.
 #define _HAS_EXCEPTIONS 0
 
+#ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable:4838)
+#endif
 #include <DirectXMath.h>
 #include <DirectXPackedVector.h>
 using namespace DirectX;
 using namespace DirectX::PackedVector;
+#ifdef _MSC_VER
 #pragma warning(pop)
+#endif
 
+#ifdef _WIN32
 // For QueryPerformanceCounter
 #include <Windows.h>
+#else
+// Windows types and macros for other platforms.
+#include "Platform.h"
+#include <time.h>
+#endif
 
 #include <stdint.h>
 
+#ifdef _MSC_VER
 #pragma warning(disable:4201) // nonstandard extension used: nameless struct/union
+#endif
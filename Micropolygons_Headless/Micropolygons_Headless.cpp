@@ -0,0 +1,511 @@
+//--------------------------------------------------------------------------------------
+// File: Micropolygons_Headless.cpp
+//
+// Command-line front end for the software micropolygon renderer. Renders a number of
+// frames into an in-memory buffer and writes out images and timings, so it can be run
+// on machines without a display.
+//--------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+
+#include "cSoftwareRasterizer.h"
+#include "cScene.h"
+#include "cSceneRenderer.h"
+#include "Utility.h"
+#include "cTaskScheduler.h"
+
+#include <vector>
+
+using namespace MicropolygonCommon;
+
+//--------------------------------------------------------------------------------------
+// Global Variables
+//--------------------------------------------------------------------------------------
+
+// Output dimensions.
+UINT	g_Width = 640;
+UINT	g_Height = 480;
+
+// "Back buffer", in the target format.
+std::vector<BYTE>	g_Buffer;
+
+// The scene and renderer.
+cScene			g_Scene;
+cSceneRenderer	g_Renderer(&g_Scene);
+
+// The rasterizer, kept between frames so its buffers are reused.
+cSoftwareRasterizer	g_Rasterizer;
+
+// Render parameters.
+UINT	g_SuperSampleFactor = 4;
+float	g_FilterWidth = 1.0f;
+eTargetFormat	g_TargetFormat = TargetFormat_BGRA8;
+
+// Run parameters.
+int			g_NumFrames = 1;
+const char*	g_SceneFile = NULL;
+const char*	g_OutputPrefix = "frame";
+const char*	g_TimingFile = NULL;
+bool		g_bWriteImages = true;
+
+//--------------------------------------------------------------------------------------
+// Forward declarations
+//--------------------------------------------------------------------------------------
+bool ParseCommandLine(int argc, char* argv[]);
+bool ParseCoverageKernel(const char* Name);
+bool ParseReconstructionFilter(const char* Name);
+bool ParseTargetFormat(const char* Name);
+void PrintUsage();
+void InitScene();
+bool LoadScene(const char* Filename);
+double Render();
+bool WriteImage(const char* Filename);
+bool WritePPM(FILE* File);
+bool WritePFM(FILE* File);
+
+
+//--------------------------------------------------------------------------------------
+// Entry point to the program.
+//--------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	if (!ParseCommandLine(argc, argv))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (g_SceneFile)
+	{
+		if (!LoadScene(g_SceneFile))
+			return 1;
+	}
+	else
+	{
+		InitScene();
+	}
+
+	g_Buffer.resize(g_Width * g_Height * GetTargetFormatPixelSize(g_TargetFormat));
+
+	FILE* TimingFile = NULL;
+	if (g_TimingFile)
+	{
+		TimingFile = fopen(g_TimingFile, "w");
+		if (!TimingFile)
+		{
+			fprintf(stderr, "Could not open timing file '%s'.\n", g_TimingFile);
+			return 1;
+		}
+		fprintf(TimingFile, "frame,seconds\n");
+	}
+
+	double TotalTime = 0.0;
+	double MinTime = 0.0;
+	double MaxTime = 0.0;
+
+	for (int Frame = 0; Frame < g_NumFrames; Frame++)
+	{
+		const double RenderTime = Render();
+
+		printf("Frame %d: render took %.3f seconds.\n", Frame, RenderTime);
+		if (TimingFile)
+			fprintf(TimingFile, "%d,%f\n", Frame, RenderTime);
+
+		TotalTime += RenderTime;
+		MinTime = Frame == 0 ? RenderTime : Min(MinTime, RenderTime);
+		MaxTime = Frame == 0 ? RenderTime : Max(MaxTime, RenderTime);
+
+		if (g_bWriteImages)
+		{
+			char Filename[1024];
+			snprintf(Filename, sizeof(Filename), "%s_%04d.%s", g_OutputPrefix, Frame,
+				g_TargetFormat == TargetFormat_RGBA16F ? "pfm" : "ppm");
+			if (!WriteImage(Filename))
+			{
+				fprintf(stderr, "Could not write image '%s'.\n", Filename);
+				return 1;
+			}
+		}
+	}
+
+	if (TimingFile)
+		fclose(TimingFile);
+
+	printf("%d frames at %ux%u %s, supersample factor %u, %s filter width %.2f, micropolygon size %.1f, bucket size %d, %d threads, %s%s kernel\n",
+		g_NumFrames, g_Width, g_Height, GetTargetFormatName(g_TargetFormat), g_SuperSampleFactor,
+		GetReconstructionFilterName(g_Rasterizer.GetReconstructionFilter()), g_FilterWidth, g_Renderer.GetMicropolygonSize(),
+		g_Renderer.GetBucketSize(), cTaskScheduler::Instance().GetNumThreads(),
+		g_Rasterizer.IsFixedPoint() ? "fixed point " : "", GetCoverageKernelName(g_Rasterizer.GetCoverageKernel()));
+	printf("Render time: min %.3f, max %.3f, average %.3f seconds.\n",
+		MinTime, MaxTime, TotalTime / g_NumFrames);
+
+	return 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Read the options from the command line. Returns false if they are invalid.
+//--------------------------------------------------------------------------------------
+bool ParseCommandLine(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* Arg = argv[i];
+
+		// Options without a value.
+		if (strcmp(Arg, "-noimages") == 0)
+		{
+			g_bWriteImages = false;
+			continue;
+		}
+		if (strcmp(Arg, "-fixedpoint") == 0)
+		{
+			g_Rasterizer.SetFixedPoint(true);
+			continue;
+		}
+
+		// Everything else takes a value.
+		if (i + 1 >= argc)
+			return false;
+		const char* Value = argv[++i];
+
+		if (strcmp(Arg, "-width") == 0)
+			g_Width = (UINT) atoi(Value);
+		else if (strcmp(Arg, "-height") == 0)
+			g_Height = (UINT) atoi(Value);
+		else if (strcmp(Arg, "-supersample") == 0)
+			g_SuperSampleFactor = (UINT) atoi(Value);
+		else if (strcmp(Arg, "-filterwidth") == 0)
+			g_FilterWidth = (float) atof(Value);
+		else if (strcmp(Arg, "-filter") == 0)
+		{
+			if (!ParseReconstructionFilter(Value))
+				return false;
+		}
+		else if (strcmp(Arg, "-format") == 0)
+		{
+			if (!ParseTargetFormat(Value))
+				return false;
+		}
+		else if (strcmp(Arg, "-polysize") == 0)
+			g_Renderer.SetMicropolygonSize((float) atof(Value));
+		else if (strcmp(Arg, "-bucketsize") == 0)
+			g_Renderer.SetBucketSize(atoi(Value));
+		else if (strcmp(Arg, "-kernel") == 0)
+		{
+			if (!ParseCoverageKernel(Value))
+				return false;
+		}
+		else if (strcmp(Arg, "-threads") == 0)
+			cTaskScheduler::Instance().SetNumThreads(atoi(Value));
+		else if (strcmp(Arg, "-frames") == 0)
+			g_NumFrames = atoi(Value);
+		else if (strcmp(Arg, "-scene") == 0)
+			g_SceneFile = Value;
+		else if (strcmp(Arg, "-output") == 0)
+			g_OutputPrefix = Value;
+		else if (strcmp(Arg, "-timing") == 0)
+			g_TimingFile = Value;
+		else
+			return false;
+	}
+
+	return g_Width > 0 && g_Height > 0 && cSoftwareRasterizer::IsMSFactorSupported(g_SuperSampleFactor) &&
+		g_FilterWidth >= 1.0f && g_Renderer.GetMicropolygonSize() > 0.0f && g_Renderer.GetBucketSize() >= 0 &&
+		g_NumFrames > 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Pick the rasterizer's coverage kernel by name. Returns false if it's unknown or the
+// CPU can't run it.
+//--------------------------------------------------------------------------------------
+bool ParseCoverageKernel(const char* Name)
+{
+	static const char* const Names[NumCoverageKernels] = { "sse", "avx2", "avx512" };
+
+	for (int i = 0; i < NumCoverageKernels; i++)
+	{
+		if (strcmp(Name, Names[i]) != 0)
+			continue;
+
+		const eCoverageKernel Kernel = (eCoverageKernel) i;
+		if (!IsCoverageKernelSupported(Kernel))
+		{
+			fprintf(stderr, "This CPU can't run the %s kernel.\n", GetCoverageKernelName(Kernel));
+			return false;
+		}
+
+		g_Rasterizer.SetCoverageKernel(Kernel);
+		return true;
+	}
+
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+// Pick the rasterizer's reconstruction filter by name. Returns false if it's unknown.
+//--------------------------------------------------------------------------------------
+bool ParseReconstructionFilter(const char* Name)
+{
+	static const char* const Names[NumReconstructionFilters] = { "box", "gaussian", "mitchell", "lanczos" };
+
+	for (int i = 0; i < NumReconstructionFilters; i++)
+	{
+		if (strcmp(Name, Names[i]) == 0)
+		{
+			g_Rasterizer.SetReconstructionFilter((eReconstructionFilter) i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+// Pick the format to resolve to by name. Returns false if it's unknown.
+//--------------------------------------------------------------------------------------
+bool ParseTargetFormat(const char* Name)
+{
+	static const char* const Names[NumTargetFormats] = { "bgra8", "rgba16", "half" };
+
+	for (int i = 0; i < NumTargetFormats; i++)
+	{
+		if (strcmp(Name, Names[i]) == 0)
+		{
+			g_TargetFormat = (eTargetFormat) i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+// Print the command line help.
+//--------------------------------------------------------------------------------------
+void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: Micropolygons_Headless [options]\n"
+		"  -width <pixels>        Output width (default 640)\n"
+		"  -height <pixels>       Output height (default 480)\n"
+		"  -supersample <factor>  Supersample factor per axis: 1, 2, 4, 8 or 16 (default 4)\n"
+		"  -filter <name>         Reconstruction filter: box, gaussian, mitchell or lanczos (default box)\n"
+		"  -filterwidth <pixels>  Reconstruction filter width (default 1)\n"
+		"  -format <name>         Format to resolve to: bgra8, rgba16 or half (default bgra8)\n"
+		"  -polysize <pixels>     Approximate micropolygon size (default %.1f)\n"
+		"  -bucketsize <pixels>   Render in square buckets of this size; 0 for none (default 0)\n"
+		"  -threads <count>       Number of threads to render with; 0 for one per core (default 0)\n"
+		"  -kernel <name>         Coverage kernel: sse, avx2 or avx512 (default is the widest the CPU runs)\n"
+		"  -frames <count>        Number of frames to render (default 1)\n"
+		"  -scene <file>          Scene file to load (default is the built-in scene)\n"
+		"  -output <prefix>       Output image prefix; writes <prefix>_NNNN.ppm, or .pfm for half (default 'frame')\n"
+		"  -timing <file>         Also write per-frame timings to a CSV file\n"
+		"  -fixedpoint            Rasterize with fixed point edge equations\n"
+		"  -noimages              Don't write images, just time the frames\n",
+		DefaultMicropolygonSize);
+}
+
+//--------------------------------------------------------------------------------------
+// Initialise the built-in scene. Same as the windowed front end's.
+//--------------------------------------------------------------------------------------
+void InitScene()
+{
+	g_Scene.m_Quads.push_back(cQuad(
+		cQuadVertex(XMFLOAT3(-0.50f, -0.5f, 0.0f),  XMUSHORTN4(1.0f, 0.0f, 0.0f, 1.0f)),
+		cQuadVertex(XMFLOAT3( 0.25f, -0.51f, 0.0f), XMUSHORTN4(0.0f, 1.0f, 0.0f, 1.0f)),
+		cQuadVertex(XMFLOAT3(-0.75f,  0.75f, 0.0f), XMUSHORTN4(0.0f, 0.0f, 1.0f, 1.0f)),
+		cQuadVertex(XMFLOAT3( 0.75f,  0.5f, 0.0f),  XMUSHORTN4(1.0f, 1.0f, 0.0f, 1.0f))));
+
+	XMStoreFloat4x4(&g_Scene.m_Transform, XMMatrixTranslation(0.0f, 0.0f, 0.0f));
+	XMStoreFloat4x4(&g_Scene.m_PrevTransform, XMMatrixTranslation(0.0f, 0.0f, 0.0f));
+}
+
+//--------------------------------------------------------------------------------------
+// Load a scene from a text file. Each line is one of:
+//
+//   quad <x y z r g b a> x4      A quad, verts in grid order (0 & 1 along the first
+//                                row, 2 & 3 along the second).
+//   transform <16 floats>        Current frame transform, row-major.
+//   prevtransform <16 floats>    Previous frame transform, row-major.
+//   translate <x y z>            Shorthand for a translation-only transform.
+//   prevtranslate <x y z>        Shorthand for a translation-only previous transform.
+//
+// Blank lines and lines starting with '#' are ignored. Both transforms default to
+// identity.
+//--------------------------------------------------------------------------------------
+bool LoadScene(const char* Filename)
+{
+	FILE* File = fopen(Filename, "r");
+	if (!File)
+	{
+		fprintf(stderr, "Could not open scene file '%s'.\n", Filename);
+		return false;
+	}
+
+	XMStoreFloat4x4(&g_Scene.m_Transform, XMMatrixIdentity());
+	XMStoreFloat4x4(&g_Scene.m_PrevTransform, XMMatrixIdentity());
+
+	char Line[1024];
+	int LineNumber = 0;
+	bool bSuccess = true;
+
+	while (bSuccess && fgets(Line, sizeof(Line), File))
+	{
+		LineNumber++;
+
+		char Command[64];
+		int Offset = 0;
+		if (sscanf(Line, " %63s%n", Command, &Offset) != 1 || Command[0] == '#')
+			continue;
+
+		// Read all the numbers on the rest of the line.
+		float Values[28];
+		int NumValues = 0;
+		const char* Cursor = Line + Offset;
+		int Read = 0;
+		while (NumValues < 28 && sscanf(Cursor, " %f%n", &Values[NumValues], &Read) == 1)
+		{
+			Cursor += Read;
+			NumValues++;
+		}
+
+		if (strcmp(Command, "quad") == 0 && NumValues == 28)
+		{
+			cQuadVertex Verts[4];
+			for (int i = 0; i < 4; i++)
+			{
+				const float* v = Values + i * 7;
+				Verts[i] = cQuadVertex(XMFLOAT3(v[0], v[1], v[2]), XMUSHORTN4(v[3], v[4], v[5], v[6]));
+			}
+			g_Scene.m_Quads.push_back(cQuad(Verts[0], Verts[1], Verts[2], Verts[3]));
+		}
+		else if (strcmp(Command, "transform") == 0 && NumValues == 16)
+		{
+			memcpy(g_Scene.m_Transform.m, Values, sizeof(g_Scene.m_Transform.m));
+		}
+		else if (strcmp(Command, "prevtransform") == 0 && NumValues == 16)
+		{
+			memcpy(g_Scene.m_PrevTransform.m, Values, sizeof(g_Scene.m_PrevTransform.m));
+		}
+		else if (strcmp(Command, "translate") == 0 && NumValues == 3)
+		{
+			XMStoreFloat4x4(&g_Scene.m_Transform, XMMatrixTranslation(Values[0], Values[1], Values[2]));
+		}
+		else if (strcmp(Command, "prevtranslate") == 0 && NumValues == 3)
+		{
+			XMStoreFloat4x4(&g_Scene.m_PrevTransform, XMMatrixTranslation(Values[0], Values[1], Values[2]));
+		}
+		else
+		{
+			fprintf(stderr, "%s(%d): could not parse '%s'.\n", Filename, LineNumber, Command);
+			bSuccess = false;
+		}
+	}
+
+	fclose(File);
+	return bSuccess;
+}
+
+//--------------------------------------------------------------------------------------
+// Render the scene. Returns the time taken in seconds.
+//--------------------------------------------------------------------------------------
+double Render()
+{
+	// Clear the "backbuffer"
+	ZeroMemory(&g_Buffer[0], g_Buffer.size());
+
+	// Point the rasterizer at the back buffer, with the current settings.
+	g_Rasterizer.SetParameters(g_Width, g_Height, g_SuperSampleFactor, g_FilterWidth, &g_Buffer[0], g_TargetFormat);
+
+	// Time the render call.
+	double StartTime = cTiming::Instance().GetSeconds();
+
+	// Render the scene using this rasterizer.
+	g_Renderer.Render(&g_Rasterizer, g_Width, g_Height);
+
+	return cTiming::Instance().GetSeconds() - StartTime;
+}
+
+//--------------------------------------------------------------------------------------
+// Write the back buffer out: a binary PPM for the integer formats, 16 bits per channel
+// for RGBA16, or a PFM for half floats.
+//--------------------------------------------------------------------------------------
+bool WriteImage(const char* Filename)
+{
+	FILE* File = fopen(Filename, "wb");
+	if (!File)
+		return false;
+
+	const bool bWritten = g_TargetFormat == TargetFormat_RGBA16F ? WritePFM(File) : WritePPM(File);
+
+	const bool bSuccess = bWritten && ferror(File) == 0;
+	fclose(File);
+	return bSuccess;
+}
+
+//--------------------------------------------------------------------------------------
+// PPM samples are gamma encoded, so RGBA16's linear channels are sRGB encoded on the
+// way out. Wide samples are big-endian.
+//--------------------------------------------------------------------------------------
+bool WritePPM(FILE* File)
+{
+	const bool bWide = g_TargetFormat == TargetFormat_RGBA16;
+	fprintf(File, "P6\n%u %u\n%u\n", g_Width, g_Height, bWide ? 65535 : 255);
+
+	std::vector<BYTE> Row(g_Width * (bWide ? 6 : 3));
+	for (UINT y = 0; y < g_Height; y++)
+	{
+		for (UINT x = 0; x < g_Width; x++)
+		{
+			const UINT i = y * g_Width + x;
+			if (bWide)
+			{
+				const XMUSHORTN4& Colour = ((const XMUSHORTN4*) &g_Buffer[0])[i];
+				const uint16_t Channels[3] = { Colour.x, Colour.y, Colour.z };
+				for (int c = 0; c < 3; c++)
+				{
+					const UINT Value = (UINT) (LinearToSRGB(Channels[c] / 65535.0f) * 65535.0f + 0.5f);
+					Row[x * 6 + c * 2 + 0] = (BYTE) (Value >> 8);
+					Row[x * 6 + c * 2 + 1] = (BYTE) Value;
+				}
+			}
+			else
+			{
+				// Unpack the rasterizer's BGRA8 layout (see eTargetFormat).
+				const DWORD Colour = ((const DWORD*) &g_Buffer[0])[i];
+				Row[x * 3 + 0] = (BYTE) (Colour >> 8);
+				Row[x * 3 + 1] = (BYTE) (Colour >> 16);
+				Row[x * 3 + 2] = (BYTE) (Colour >> 24);
+			}
+		}
+		if (fwrite(&Row[0], 1, Row.size(), File) != Row.size())
+			return false;
+	}
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// PFM holds linear floats, little-endian (the negative scale), with the rows from the
+// bottom up.
+//--------------------------------------------------------------------------------------
+bool WritePFM(FILE* File)
+{
+	fprintf(File, "PF\n%u %u\n-1.0\n", g_Width, g_Height);
+
+	std::vector<float> Row(g_Width * 3);
+	for (UINT y = g_Height; y-- > 0;)
+	{
+		for (UINT x = 0; x < g_Width; x++)
+		{
+			const XMHALF4& Colour = ((const XMHALF4*) &g_Buffer[0])[y * g_Width + x];
+			Row[x * 3 + 0] = XMConvertHalfToFloat(Colour.x);
+			Row[x * 3 + 1] = XMConvertHalfToFloat(Colour.y);
+			Row[x * 3 + 2] = XMConvertHalfToFloat(Colour.z);
+		}
+		if (fwrite(&Row[0], sizeof(float), Row.size(), File) != Row.size())
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,51 @@
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently
+//
+
+#pragma once
+
+// Disable STL exceptions.
+#define _HAS_EXCEPTIONS 0
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#ifndef VC_EXTRALEAN
+#define VC_EXTRALEAN
+#endif
+
+#include <windows.h>
+
+#else
+
+// Windows types and macros for other platforms.
+#include "Platform.h"
+
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable:4838)
+#endif
+#include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4201) // nonstandard extension used: nameless struct/union
+#pragma warning(disable:4996) // 'fopen': This function or variable may be unsafe
+#endif
@@ -35,6 +35,9 @@ std::vector<DWORD>	g_Buffer;
 cScene			g_Scene;
 cSceneRenderer	g_Renderer(&g_Scene);
 
+// The rasterizer, kept between frames so its buffers are reused.
+cSoftwareRasterizer	g_Rasterizer;
+
 // Render parameters.
 UINT	g_SuperSampleFactor = 4;
 float	g_FilterWidth = 1.0f;
@@ -196,6 +199,18 @@ void OnKeyboard(WPARAM wParam, LPARAM /*lParam*/)
 		else
 			g_FilterWidth = Max(1.0f, g_FilterWidth - 0.25f);
 		break;
+
+	case 'R':
+		g_Rasterizer.SetReconstructionFilter((eReconstructionFilter)
+			((g_Rasterizer.GetReconstructionFilter() + 1) % NumReconstructionFilters));
+		break;
+
+	case 'B':
+		if (g_Renderer.GetBucketSize() > 0)
+			g_Renderer.SetBucketSize(0);
+		else
+			g_Renderer.SetBucketSize(DefaultBucketSize);
+		break;
 	}
 }
 
@@ -232,14 +247,14 @@ void Render()
 	// Clear the "backbuffer"
 	ZeroMemory(&g_Buffer[0], g_Buffer.size() * sizeof(DWORD));
 
-	// Construct new rasterizer.
-	cSoftwareRasterizer Rasterizer(g_Width, g_Height, g_SuperSampleFactor, g_FilterWidth, &g_Buffer[0]);
+	// Point the rasterizer at the back buffer, with the current settings.
+	g_Rasterizer.SetParameters(g_Width, g_Height, g_SuperSampleFactor, g_FilterWidth, &g_Buffer[0]);
 
 	// Time the render call.
 	double StartTime = cTiming::Instance().GetSeconds();
 
 	// Render the scene using this rasterizer.
-	g_Renderer.Render(&Rasterizer, g_Width, g_Height);
+	g_Renderer.Render(&g_Rasterizer, g_Width, g_Height);
 
 	double RenderTime = cTiming::Instance().GetSeconds() - StartTime;
 
@@ -287,11 +302,20 @@ void DrawHUD(HDC hdc)
 		if (NumChars > 0)
 			TextOut(hdc, 10, 30, Buffer, NumChars);
 
-		// Output filter width.
-		NumChars = swprintf_s(Buffer, BufferSize, L"Filter width: %.2f", g_FilterWidth);
+		// Output filter and width.
+		NumChars = swprintf_s(Buffer, BufferSize, L"Filter: %hs, width %.2f",
+			GetReconstructionFilterName(g_Rasterizer.GetReconstructionFilter()), g_FilterWidth);
 		if (NumChars > 0)
 			TextOut(hdc, 10, 50, Buffer, NumChars);
 
+		// Output bucket size.
+		if (g_Renderer.GetBucketSize() > 0)
+			NumChars = swprintf_s(Buffer, BufferSize, L"Bucket size: %d", g_Renderer.GetBucketSize());
+		else
+			NumChars = swprintf_s(Buffer, BufferSize, L"Bucket size: off");
+		if (NumChars > 0)
+			TextOut(hdc, 10, 70, Buffer, NumChars);
+
 		// Restore the original font.
 		SelectObject(hdc, hOldFont);
 	}
@@ -0,0 +1,991 @@
+//--------------------------------------------------------------------------------------
+// Coverage kernels for SSE, AVX2 and AVX-512.
+//
+// The wide kernels are compiled for their instruction sets function by function, so
+// the rest of the program doesn't need them and they're only called if the CPU has
+// them.
+//--------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "cCoverageKernels.h"
+#include "Maths.h"
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_AVX2		__attribute__((target("avx2")))
+#define TARGET_AVX512	__attribute__((target("avx2,avx512f")))
+#endif
+
+namespace
+{
+
+//--------------------------------------------------------------------------------------
+// CPU feature detection.
+//--------------------------------------------------------------------------------------
+
+#ifdef _MSC_VER
+
+// Has the OS enabled saving all the register state in Mask (see XGETBV)?
+bool IsOSStateEnabled(unsigned long long Mask)
+{
+	int Info[4];
+	__cpuid(Info, 1);
+	const bool bOSXSave = (Info[2] & (1 << 27)) != 0;
+	return bOSXSave && (_xgetbv(0) & Mask) == Mask;
+}
+
+// Bit of CPUID leaf 1's ECX.
+bool HasFeature(int Bit)
+{
+	int Info[4];
+	__cpuid(Info, 1);
+	return (Info[2] & (1 << Bit)) != 0;
+}
+
+// Bit of CPUID leaf 7's EBX.
+bool HasExtendedFeature(int Bit)
+{
+	int Info[4];
+	__cpuid(Info, 0);
+	if (Info[0] < 7)
+		return false;
+
+	__cpuidex(Info, 7, 0);
+	return (Info[1] & (1 << Bit)) != 0;
+}
+
+bool CPUHasAVX2()
+{
+	// XMM & YMM state. The target format conversions use F16C alongside AVX2.
+	return IsOSStateEnabled(0x6) && HasExtendedFeature(5) && HasFeature(29);
+}
+
+bool CPUHasAVX512()
+{
+	// XMM, YMM, opmask and both halves of ZMM state.
+	return CPUHasAVX2() && IsOSStateEnabled(0xE6) && HasExtendedFeature(16);
+}
+
+#else
+
+// These check the OS supports the registers too. The target format conversions use
+// F16C alongside AVX2.
+bool CPUHasAVX2() { return __builtin_cpu_supports("avx2") != 0 && __builtin_cpu_supports("f16c") != 0; }
+bool CPUHasAVX512() { return CPUHasAVX2() && __builtin_cpu_supports("avx512f") != 0; }
+
+#endif
+
+//--------------------------------------------------------------------------------------
+// Jitter rows for a screen sample row, offset to the column of screen sample x.
+//--------------------------------------------------------------------------------------
+template <class T>
+inline const T* GetJitterRow(const T* Jitter, const cCoverageTarget& Target, INT x, INT y)
+{
+	return Jitter + (y % Target.m_JitterSize) * 2 * Target.m_JitterSize + x % Target.m_JitterSize;
+}
+
+//--------------------------------------------------------------------------------------
+// The sample at screen sample (x, y).
+//--------------------------------------------------------------------------------------
+inline uint64_t* GetSample(const cCoverageTarget& Target, INT x, INT y)
+{
+	const INT Column = x - Target.m_OriginX;
+	const INT Row = y - Target.m_OriginY;
+	uint64_t* Tile = Target.m_Tiles[(Row / SampleTileSize) * Target.m_NumTilesX + Column / SampleTileSize];
+	_ASSERTE(Tile);
+	return Tile + (Row % SampleTileSize) * SampleTileSize + Column % SampleTileSize;
+}
+
+//--------------------------------------------------------------------------------------
+// All kernels work a row at a time. The edge functions (A*x + B*y - C) are evaluated
+// at each sample point before jittering, then moved out to the jittered position:
+//
+//   Value = Base + A * i + (A * JitterX + B * JitterY)
+//
+// where i is the sample's index along the row. Base + A*i is stepped along the row by
+// adding A and Base down the rectangle by adding B, so only the jitter term in
+// brackets is multiplied out, once per row. A sample is inside if the value is not
+// negative for all four edges. The rectangle must lie within one column of buffer, so
+// each of its rows is contiguous.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// SSE: one sample at a time, with the four edges in the lanes of a vector.
+//--------------------------------------------------------------------------------------
+void CoverQuad_SSE(const cCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	const INT Width = Quad.XMax - Quad.XMin + 1;
+	_ASSERTE(Width <= Target.m_JitterSize && Quad.XMax <= GetSampleTileEnd(Quad.XMin));
+
+	XMVECTOR Base = Quad.m_As * (float) Quad.XMin + Quad.m_Bs * (float) Quad.YMin - Quad.m_Cs;
+
+	for (INT y = Quad.YMin; y <= Quad.YMax; y++, Base += Quad.m_Bs)
+	{
+		const float* JitterXs = GetJitterRow(Target.m_JitterXs, Target, Quad.XMin, y);
+		const float* JitterYs = GetJitterRow(Target.m_JitterYs, Target, Quad.XMin, y);
+		uint64_t* Dest = GetSample(Target, Quad.XMin, y);
+
+		XMVECTOR Stepped = Base;
+		for (INT i = 0; i < Width; i++, Stepped += Quad.m_As)
+		{
+			const XMVECTOR Values = Stepped + Quad.m_As * XMVectorReplicate(JitterXs[i]) + Quad.m_Bs * XMVectorReplicate(JitterYs[i]);
+			if (!_mm_movemask_ps(XMVectorLess(Values, XMVectorZero())))
+			{
+				Dest[i] = Quad.m_Colour;
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// AVX2: eight samples at a time, with the edges done one after another.
+//--------------------------------------------------------------------------------------
+TARGET_AVX2 void CoverQuad_AVX2(const cCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	const INT Width = Quad.XMax - Quad.XMin + 1;
+	_ASSERTE(Width <= Target.m_JitterSize && Quad.XMax <= GetSampleTileEnd(Quad.XMin));
+
+	XMFLOAT4A As, Bs, Cs;
+	XMStoreFloat4A(&As, Quad.m_As);
+	XMStoreFloat4A(&Bs, Quad.m_Bs);
+	XMStoreFloat4A(&Cs, Quad.m_Cs);
+	const float* a = &As.x;
+	const float* b = &Bs.x;
+	const float* c = &Cs.x;
+
+	__m256 EdgeAs[4], EdgeBs[4];
+	for (int e = 0; e < 4; e++)
+	{
+		EdgeAs[e] = _mm256_set1_ps(a[e]);
+		EdgeBs[e] = _mm256_set1_ps(b[e]);
+	}
+
+	const __m256 LaneIndex = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	const __m256i Colour = _mm256_set1_epi64x((long long) Quad.m_Colour);
+
+	// Edge functions at each lane's sample point in the first row before jittering,
+	// and how much they change from one vector of samples to the next.
+	__m256 Bases[4], VectorSteps[4];
+	for (int e = 0; e < 4; e++)
+	{
+		Bases[e] = _mm256_add_ps(_mm256_set1_ps(a[e] * (float) Quad.XMin + b[e] * (float) Quad.YMin - c[e]), _mm256_mul_ps(EdgeAs[e], LaneIndex));
+		VectorSteps[e] = _mm256_set1_ps(8.0f * a[e]);
+	}
+
+	// A row is no wider than a tile.
+	const INT MaxVectors = SampleTileSize / 8;
+	const INT NumVectors = (Width + 7) / 8;
+
+	for (INT y = Quad.YMin; y <= Quad.YMax; y++)
+	{
+		const float* JitterXs = GetJitterRow(Target.m_JitterXs, Target, Quad.XMin, y);
+		const float* JitterYs = GetJitterRow(Target.m_JitterYs, Target, Quad.XMin, y);
+		uint64_t* Dest = GetSample(Target, Quad.XMin, y);
+
+		__m256 JitterTerms[MaxVectors][4];
+		for (INT v = 0; v < NumVectors; v++)
+		{
+			const __m256 OffsetXs = _mm256_loadu_ps(JitterXs + v * 8);
+			const __m256 OffsetYs = _mm256_loadu_ps(JitterYs + v * 8);
+			for (int e = 0; e < 4; e++)
+			{
+				JitterTerms[v][e] = _mm256_add_ps(_mm256_mul_ps(EdgeAs[e], OffsetXs), _mm256_mul_ps(EdgeBs[e], OffsetYs));
+			}
+		}
+
+		__m256 Stepped[4];
+		for (int e = 0; e < 4; e++)
+		{
+			Stepped[e] = Bases[e];
+			Bases[e] = _mm256_add_ps(Bases[e], EdgeBs[e]);
+		}
+
+		for (INT v = 0; v < NumVectors; v++)
+		{
+			// Start with the lanes that are within the row.
+			__m256 Inside = _mm256_cmp_ps(LaneIndex, _mm256_set1_ps((float) (Width - v * 8)), _CMP_LT_OQ);
+			for (int e = 0; e < 4; e++)
+			{
+				Inside = _mm256_and_ps(Inside, _mm256_cmp_ps(_mm256_add_ps(Stepped[e], JitterTerms[v][e]), _mm256_setzero_ps(), _CMP_NLT_UQ));
+				Stepped[e] = _mm256_add_ps(Stepped[e], VectorSteps[e]);
+			}
+
+			if (!_mm256_movemask_ps(Inside))
+				continue;
+
+			// Widen the mask to the 64 bit samples and store four at a time.
+			const __m256i Mask = _mm256_castps_si256(Inside);
+			const __m256i MaskLo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(Mask));
+			const __m256i MaskHi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(Mask, 1));
+			_mm256_maskstore_epi64(reinterpret_cast<long long*>(Dest + v * 8), MaskLo, Colour);
+			_mm256_maskstore_epi64(reinterpret_cast<long long*>(Dest + v * 8 + 4), MaskHi, Colour);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// AVX-512: sixteen samples at a time, with the edges done one after another.
+//--------------------------------------------------------------------------------------
+TARGET_AVX512 void CoverQuad_AVX512(const cCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	const INT Width = Quad.XMax - Quad.XMin + 1;
+	_ASSERTE(Width <= Target.m_JitterSize && Quad.XMax <= GetSampleTileEnd(Quad.XMin));
+
+	XMFLOAT4A As, Bs, Cs;
+	XMStoreFloat4A(&As, Quad.m_As);
+	XMStoreFloat4A(&Bs, Quad.m_Bs);
+	XMStoreFloat4A(&Cs, Quad.m_Cs);
+	const float* a = &As.x;
+	const float* b = &Bs.x;
+	const float* c = &Cs.x;
+
+	__m512 EdgeAs[4], EdgeBs[4];
+	for (int e = 0; e < 4; e++)
+	{
+		EdgeAs[e] = _mm512_set1_ps(a[e]);
+		EdgeBs[e] = _mm512_set1_ps(b[e]);
+	}
+
+	const __m512 LaneIndex = _mm512_setr_ps(
+		0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+		8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f);
+	const __m512i Colour = _mm512_set1_epi64((long long) Quad.m_Colour);
+
+	// Edge functions at each lane's sample point in the first row before jittering.
+	// A row is no wider than a tile, so it fits in one vector.
+	static_assert(SampleTileSize <= 16, "A row of samples must fit in one vector");
+	__m512 Bases[4];
+	for (int e = 0; e < 4; e++)
+	{
+		Bases[e] = _mm512_add_ps(_mm512_set1_ps(a[e] * (float) Quad.XMin + b[e] * (float) Quad.YMin - c[e]), _mm512_mul_ps(EdgeAs[e], LaneIndex));
+	}
+
+	// Start with the lanes that are within the row.
+	const __mmask16 InRow = (__mmask16) (Width >= 16 ? 0xFFFF : (1 << Width) - 1);
+
+	for (INT y = Quad.YMin; y <= Quad.YMax; y++)
+	{
+		const float* JitterXs = GetJitterRow(Target.m_JitterXs, Target, Quad.XMin, y);
+		const float* JitterYs = GetJitterRow(Target.m_JitterYs, Target, Quad.XMin, y);
+		uint64_t* Dest = GetSample(Target, Quad.XMin, y);
+
+		const __m512 OffsetXs = _mm512_maskz_loadu_ps(InRow, JitterXs);
+		const __m512 OffsetYs = _mm512_maskz_loadu_ps(InRow, JitterYs);
+
+		__mmask16 Inside = InRow;
+		for (int e = 0; e < 4; e++)
+		{
+			const __m512 JitterTerm = _mm512_add_ps(_mm512_mul_ps(EdgeAs[e], OffsetXs), _mm512_mul_ps(EdgeBs[e], OffsetYs));
+			Inside = _mm512_mask_cmp_ps_mask(Inside, _mm512_add_ps(Bases[e], JitterTerm), _mm512_setzero_ps(), _CMP_NLT_UQ);
+			Bases[e] = _mm512_add_ps(Bases[e], EdgeBs[e]);
+		}
+
+		if (!Inside)
+			continue;
+
+		// Eight 64 bit samples per store.
+		_mm512_mask_storeu_epi64(Dest, (__mmask8) Inside, Colour);
+		_mm512_mask_storeu_epi64(Dest + 8, (__mmask8) (Inside >> 8), Colour);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Per-lane 32 bit multiply, keeping the low half of each product. SSE2 only has an
+// unsigned 32 x 32 -> 64 bit multiply of the even lanes, so do the even and odd lanes
+// separately and interleave the results.
+//--------------------------------------------------------------------------------------
+inline __m128i MultiplyInt(__m128i a, __m128i b)
+{
+	const __m128i Even = _mm_mul_epu32(a, b);
+	const __m128i Odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(Even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(Odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+//--------------------------------------------------------------------------------------
+// The fixed point kernels follow the float ones, working in sub-samples:
+//
+//   Value = E + A * (i * SubSampleScale + JitterX) + B * (j * SubSampleScale + JitterY)
+//
+// for the sample i along and j down from the rectangle's top-left. The sign bit of the
+// value is set if the sample is outside the edge.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// SSE: one sample at a time, with the four edges in the lanes of a vector.
+//--------------------------------------------------------------------------------------
+void CoverFixedQuad_SSE(const cFixedCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	const INT Width = Quad.XMax - Quad.XMin + 1;
+	_ASSERTE(Width <= Target.m_JitterSize && Quad.XMax <= GetSampleTileEnd(Quad.XMin));
+
+	const __m128i As = _mm_load_si128(reinterpret_cast<const __m128i*>(Quad.m_As));
+	const __m128i Bs = _mm_load_si128(reinterpret_cast<const __m128i*>(Quad.m_Bs));
+	const __m128i Es = _mm_load_si128(reinterpret_cast<const __m128i*>(Quad.m_Es));
+
+	for (INT j = 0; j <= Quad.YMax - Quad.YMin; j++)
+	{
+		const __m128i RowEs = _mm_add_epi32(Es, MultiplyInt(Bs, _mm_set1_epi32(j * SubSampleScale)));
+
+		const int32_t* JitterXs = GetJitterRow(Target.m_FixedJitterXs, Target, Quad.XMin, Quad.YMin + j);
+		const int32_t* JitterYs = GetJitterRow(Target.m_FixedJitterYs, Target, Quad.XMin, Quad.YMin + j);
+		uint64_t* Dest = GetSample(Target, Quad.XMin, Quad.YMin + j);
+
+		for (INT i = 0; i < Width; i++)
+		{
+			const __m128i Values = _mm_add_epi32(_mm_add_epi32(RowEs,
+				MultiplyInt(As, _mm_set1_epi32(i * SubSampleScale + JitterXs[i]))),
+				MultiplyInt(Bs, _mm_set1_epi32(JitterYs[i])));
+			if (!_mm_movemask_ps(_mm_castsi128_ps(Values)))
+			{
+				Dest[i] = Quad.m_Colour;
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// AVX2: eight samples at a time, with the edges done one after another.
+//--------------------------------------------------------------------------------------
+TARGET_AVX2 void CoverFixedQuad_AVX2(const cFixedCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	const INT Width = Quad.XMax - Quad.XMin + 1;
+	_ASSERTE(Width <= Target.m_JitterSize && Quad.XMax <= GetSampleTileEnd(Quad.XMin));
+
+	__m256i EdgeAs[4], EdgeBs[4];
+	for (int e = 0; e < 4; e++)
+	{
+		EdgeAs[e] = _mm256_set1_epi32(Quad.m_As[e]);
+		EdgeBs[e] = _mm256_set1_epi32(Quad.m_Bs[e]);
+	}
+
+	const __m256i LaneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i Colour = _mm256_set1_epi64x((long long) Quad.m_Colour);
+
+	for (INT j = 0; j <= Quad.YMax - Quad.YMin; j++)
+	{
+		__m256i RowEs[4];
+		for (int e = 0; e < 4; e++)
+		{
+			RowEs[e] = _mm256_set1_epi32(Quad.m_Es[e] + Quad.m_Bs[e] * j * SubSampleScale);
+		}
+
+		const int32_t* JitterXs = GetJitterRow(Target.m_FixedJitterXs, Target, Quad.XMin, Quad.YMin + j);
+		const int32_t* JitterYs = GetJitterRow(Target.m_FixedJitterYs, Target, Quad.XMin, Quad.YMin + j);
+		uint64_t* Dest = GetSample(Target, Quad.XMin, Quad.YMin + j);
+
+		for (INT i = 0; i < Width; i += 8)
+		{
+			const __m256i Index = _mm256_add_epi32(_mm256_set1_epi32(i), LaneIndex);
+			const __m256i OffsetXs = _mm256_add_epi32(_mm256_slli_epi32(Index, SubSampleBits),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(JitterXs + i)));
+			const __m256i OffsetYs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(JitterYs + i));
+
+			// Collect the sign bits of all four edges.
+			__m256i Outside = _mm256_setzero_si256();
+			for (int e = 0; e < 4; e++)
+			{
+				const __m256i Values = _mm256_add_epi32(_mm256_add_epi32(RowEs[e],
+					_mm256_mullo_epi32(EdgeAs[e], OffsetXs)), _mm256_mullo_epi32(EdgeBs[e], OffsetYs));
+				Outside = _mm256_or_si256(Outside, Values);
+			}
+
+			// Inside lanes that are within the row.
+			const __m256i InRow = _mm256_cmpgt_epi32(_mm256_set1_epi32(Width - i), LaneIndex);
+			const __m256i Mask = _mm256_andnot_si256(_mm256_srai_epi32(Outside, 31), InRow);
+			if (!_mm256_movemask_epi8(Mask))
+				continue;
+
+			// Widen the mask to the 64 bit samples and store four at a time.
+			const __m256i MaskLo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(Mask));
+			const __m256i MaskHi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(Mask, 1));
+			_mm256_maskstore_epi64(reinterpret_cast<long long*>(Dest + i), MaskLo, Colour);
+			_mm256_maskstore_epi64(reinterpret_cast<long long*>(Dest + i + 4), MaskHi, Colour);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// AVX-512: sixteen samples at a time, with the edges done one after another.
+//--------------------------------------------------------------------------------------
+TARGET_AVX512 void CoverFixedQuad_AVX512(const cFixedCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	const INT Width = Quad.XMax - Quad.XMin + 1;
+	_ASSERTE(Width <= Target.m_JitterSize && Quad.XMax <= GetSampleTileEnd(Quad.XMin));
+
+	__m512i EdgeAs[4], EdgeBs[4];
+	for (int e = 0; e < 4; e++)
+	{
+		EdgeAs[e] = _mm512_set1_epi32(Quad.m_As[e]);
+		EdgeBs[e] = _mm512_set1_epi32(Quad.m_Bs[e]);
+	}
+
+	const __m512i LaneIndex = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m512i Colour = _mm512_set1_epi64((long long) Quad.m_Colour);
+
+	for (INT j = 0; j <= Quad.YMax - Quad.YMin; j++)
+	{
+		__m512i RowEs[4];
+		for (int e = 0; e < 4; e++)
+		{
+			RowEs[e] = _mm512_set1_epi32(Quad.m_Es[e] + Quad.m_Bs[e] * j * SubSampleScale);
+		}
+
+		const int32_t* JitterXs = GetJitterRow(Target.m_FixedJitterXs, Target, Quad.XMin, Quad.YMin + j);
+		const int32_t* JitterYs = GetJitterRow(Target.m_FixedJitterYs, Target, Quad.XMin, Quad.YMin + j);
+		uint64_t* Dest = GetSample(Target, Quad.XMin, Quad.YMin + j);
+
+		for (INT i = 0; i < Width; i += 16)
+		{
+			const __m512i Index = _mm512_add_epi32(_mm512_set1_epi32(i), LaneIndex);
+			const __m512i OffsetXs = _mm512_add_epi32(_mm512_slli_epi32(Index, SubSampleBits), _mm512_loadu_si512(JitterXs + i));
+			const __m512i OffsetYs = _mm512_loadu_si512(JitterYs + i);
+
+			// Start with the lanes that are within the row.
+			__mmask16 Inside = (__mmask16) (Width - i >= 16 ? 0xFFFF : (1 << (Width - i)) - 1);
+			for (int e = 0; e < 4; e++)
+			{
+				const __m512i Values = _mm512_add_epi32(_mm512_add_epi32(RowEs[e],
+					_mm512_mullo_epi32(EdgeAs[e], OffsetXs)), _mm512_mullo_epi32(EdgeBs[e], OffsetYs));
+				Inside = _mm512_mask_cmpge_epi32_mask(Inside, Values, _mm512_setzero_si512());
+			}
+
+			if (!Inside)
+				continue;
+
+			// Eight 64 bit samples per store.
+			_mm512_mask_storeu_epi64(Dest + i, (__mmask8) Inside, Colour);
+			_mm512_mask_storeu_epi64(Dest + i + 8, (__mmask8) (Inside >> 8), Colour);
+		}
+	}
+}
+
+// How much of a block of samples a uPoly covers.
+enum eBlockCoverage
+{
+	BlockCoverage_None,
+	BlockCoverage_Partial,
+	BlockCoverage_Full,
+};
+
+//--------------------------------------------------------------------------------------
+// Fill an inclusive rectangle of samples, a column of tiles at a time.
+//--------------------------------------------------------------------------------------
+void FillSamples(const cCoverageTarget& Target, INT XMin, INT YMin, INT XMax, INT YMax, uint64_t Colour)
+{
+	for (INT Left = XMin; Left <= XMax; Left = GetSampleTileEnd(Left) + 1)
+	{
+		const INT Right = Min(GetSampleTileEnd(Left), XMax);
+		for (INT y = YMin; y <= YMax; y++)
+		{
+			uint64_t* Dest = GetSample(Target, Left, y);
+			for (INT i = 0; i <= Right - Left; i++)
+			{
+				Dest[i] = Colour;
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Pass an inclusive rectangle of a uPoly to a kernel a column of tiles at a time.
+//--------------------------------------------------------------------------------------
+template <class tQuad, class tKernel>
+void CoverInTiles(const tQuad& Quad, INT XMin, INT YMin, INT XMax, INT YMax, const tKernel& Kernel)
+{
+	for (INT Left = XMin; Left <= XMax; Left = GetSampleTileEnd(Left) + 1)
+	{
+		tQuad Part = Quad;
+		Part.XMin = Left;
+		Part.YMin = YMin;
+		Part.XMax = Min(GetSampleTileEnd(Left), XMax);
+		Part.YMax = YMax;
+		Kernel(Part);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Index of the lowest set bit.
+//--------------------------------------------------------------------------------------
+inline UINT FirstBit(UINT Bits)
+{
+#ifdef _MSC_VER
+	unsigned long Index;
+	_BitScanForward(&Index, Bits);
+	return Index;
+#else
+	return __builtin_ctz(Bits);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// A batch of small uPolys, one per lane. The edge equations are transposed, so each
+// row holds the same edge of every uPoly. The batch kernels work out which slots each
+// lane covers, then the samples are written a uPoly at a time.
+//--------------------------------------------------------------------------------------
+template <int NumLanes>
+class alignas(32) cQuadBatch
+{
+public:
+
+	cQuadBatch(const cCoverageQuad* Quads, INT NumQuads, const cCoverageTarget& Target)
+		: m_MaxWidth(0)
+		, m_MaxHeight(0)
+	{
+		_ASSERTE(NumQuads > 0 && NumQuads <= NumLanes);
+
+		for (INT l = 0; l < NumLanes; l++)
+		{
+			// Spare lanes repeat the first uPoly, and what they cover isn't written.
+			const cCoverageQuad& Quad = Quads[l < NumQuads ? l : 0];
+
+			XMFLOAT4A As, Bs, Cs;
+			XMStoreFloat4A(&As, Quad.m_As);
+			XMStoreFloat4A(&Bs, Quad.m_Bs);
+			XMStoreFloat4A(&Cs, Quad.m_Cs);
+			for (int e = 0; e < 4; e++)
+			{
+				m_As[e][l] = (&As.x)[e];
+				m_Bs[e][l] = (&Bs.x)[e];
+				m_Cs[e][l] = (&Cs.x)[e];
+			}
+
+			m_XMins[l] = (float) Quad.XMin;
+			m_YMins[l] = (float) Quad.YMin;
+			m_JitterColumns[l] = Quad.XMin % Target.m_JitterSize;
+			m_JitterRows[l] = Quad.YMin % Target.m_JitterSize;
+
+			m_MaxWidth = Max(m_MaxWidth, Quad.XMax - Quad.XMin + 1);
+			m_MaxHeight = Max(m_MaxHeight, Quad.YMax - Quad.YMin + 1);
+		}
+
+		_ASSERTE(m_MaxWidth <= CoverageBatchMaxSize && m_MaxHeight <= CoverageBatchMaxSize);
+		_ASSERTE(m_MaxWidth <= SampleTileSize);
+	}
+
+	// Offsets into the jitter tables of each lane's first sample in slot row y.
+	void GetJitterOffsets(const cCoverageTarget& Target, INT y, INT* Offsets) const
+	{
+		for (INT l = 0; l < NumLanes; l++)
+		{
+			INT Row = m_JitterRows[l] + y;
+			if (Row >= Target.m_JitterSize)
+			{
+				Row -= Target.m_JitterSize;
+			}
+			Offsets[l] = Row * 2 * Target.m_JitterSize + m_JitterColumns[l];
+		}
+	}
+
+	// Write the covered samples in uPoly order, so later uPolys win as usual. A uPoly
+	// is no wider than a tile, so its rows can only run on into the next one.
+	void Write(const cCoverageQuad* Quads, INT NumQuads, const cCoverageTarget& Target) const
+	{
+		for (INT l = 0; l < NumQuads; l++)
+		{
+			const cCoverageQuad& Quad = Quads[l];
+			const UINT WidthMask = (2u << (Quad.XMax - Quad.XMin)) - 1;
+
+			// Slots from Split on are in the next tile.
+			const INT Split = GetSampleTileEnd(Quad.XMin) + 1 - Quad.XMin;
+			const UINT FirstTileMask = (1u << Split) - 1;
+
+			for (INT y = 0; y <= Quad.YMax - Quad.YMin; y++)
+			{
+				const UINT RowMask = (UINT) m_RowMasks[y][l] & WidthMask;
+
+				uint64_t* Dest = GetSample(Target, Quad.XMin, Quad.YMin + y);
+				for (UINT Bits = RowMask & FirstTileMask; Bits; Bits &= Bits - 1)
+				{
+					Dest[FirstBit(Bits)] = Quad.m_Colour;
+				}
+
+				if (RowMask >> Split)
+				{
+					Dest = GetSample(Target, Quad.XMin + Split, Quad.YMin + y);
+					for (UINT Bits = RowMask >> Split; Bits; Bits &= Bits - 1)
+					{
+						Dest[FirstBit(Bits)] = Quad.m_Colour;
+					}
+				}
+			}
+		}
+	}
+
+	// Edge equations by edge, then lane.
+	float	m_As[4][NumLanes];
+	float	m_Bs[4][NumLanes];
+	float	m_Cs[4][NumLanes];
+
+	// Each lane's first sample, and where it is in the jitter tables.
+	float	m_XMins[NumLanes];
+	float	m_YMins[NumLanes];
+	INT		m_JitterColumns[NumLanes];
+	INT		m_JitterRows[NumLanes];
+
+	// Slots to test in each direction.
+	INT		m_MaxWidth, m_MaxHeight;
+
+	// For each row of slots, a bit per slot that each lane covers.
+	INT		m_RowMasks[CoverageBatchMaxSize][NumLanes];
+};
+
+//--------------------------------------------------------------------------------------
+// SSE: four uPolys at a time.
+//--------------------------------------------------------------------------------------
+void CoverQuads_SSE(const cCoverageQuad* Quads, INT NumQuads, const cCoverageTarget& Target)
+{
+	cQuadBatch<4> Batch(Quads, NumQuads, Target);
+
+	__m128 EdgeAs[4], EdgeBs[4], EdgeCs[4];
+	for (int e = 0; e < 4; e++)
+	{
+		EdgeAs[e] = _mm_load_ps(Batch.m_As[e]);
+		EdgeBs[e] = _mm_load_ps(Batch.m_Bs[e]);
+		EdgeCs[e] = _mm_load_ps(Batch.m_Cs[e]);
+	}
+
+	// Edge functions at each lane's first sample point before jittering, stepped down
+	// the slots by B and along them by A.
+	__m128 Bases[4];
+	for (int e = 0; e < 4; e++)
+	{
+		Bases[e] = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(EdgeAs[e], _mm_load_ps(Batch.m_XMins)), _mm_mul_ps(EdgeBs[e], _mm_load_ps(Batch.m_YMins))), EdgeCs[e]);
+	}
+
+	for (INT y = 0; y < Batch.m_MaxHeight; y++)
+	{
+		INT Offsets[4];
+		Batch.GetJitterOffsets(Target, y, Offsets);
+
+		__m128 Stepped[4];
+		for (int e = 0; e < 4; e++)
+		{
+			Stepped[e] = Bases[e];
+			Bases[e] = _mm_add_ps(Bases[e], EdgeBs[e]);
+		}
+
+		__m128i RowMask = _mm_setzero_si128();
+		for (INT x = 0; x < Batch.m_MaxWidth; x++)
+		{
+			const float* JitterXs = Target.m_JitterXs + x;
+			const float* JitterYs = Target.m_JitterYs + x;
+			const __m128 OffsetXs = _mm_setr_ps(JitterXs[Offsets[0]], JitterXs[Offsets[1]], JitterXs[Offsets[2]], JitterXs[Offsets[3]]);
+			const __m128 OffsetYs = _mm_setr_ps(JitterYs[Offsets[0]], JitterYs[Offsets[1]], JitterYs[Offsets[2]], JitterYs[Offsets[3]]);
+
+			__m128 Inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int e = 0; e < 4; e++)
+			{
+				const __m128 JitterTerm = _mm_add_ps(_mm_mul_ps(EdgeAs[e], OffsetXs), _mm_mul_ps(EdgeBs[e], OffsetYs));
+				Inside = _mm_and_ps(Inside, _mm_cmpnlt_ps(_mm_add_ps(Stepped[e], JitterTerm), _mm_setzero_ps()));
+				Stepped[e] = _mm_add_ps(Stepped[e], EdgeAs[e]);
+			}
+
+			RowMask = _mm_or_si128(RowMask, _mm_and_si128(_mm_castps_si128(Inside), _mm_set1_epi32(1 << x)));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Batch.m_RowMasks[y]), RowMask);
+	}
+
+	Batch.Write(Quads, NumQuads, Target);
+}
+
+//--------------------------------------------------------------------------------------
+// AVX2: eight uPolys at a time, gathering their jitter.
+//--------------------------------------------------------------------------------------
+TARGET_AVX2 void CoverQuads_AVX2(const cCoverageQuad* Quads, INT NumQuads, const cCoverageTarget& Target)
+{
+	cQuadBatch<8> Batch(Quads, NumQuads, Target);
+
+	__m256 EdgeAs[4], EdgeBs[4], EdgeCs[4];
+	for (int e = 0; e < 4; e++)
+	{
+		EdgeAs[e] = _mm256_load_ps(Batch.m_As[e]);
+		EdgeBs[e] = _mm256_load_ps(Batch.m_Bs[e]);
+		EdgeCs[e] = _mm256_load_ps(Batch.m_Cs[e]);
+	}
+
+	// Edge functions at each lane's first sample point before jittering, stepped down
+	// the slots by B and along them by A.
+	__m256 Bases[4];
+	for (int e = 0; e < 4; e++)
+	{
+		Bases[e] = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(EdgeAs[e], _mm256_load_ps(Batch.m_XMins)), _mm256_mul_ps(EdgeBs[e], _mm256_load_ps(Batch.m_YMins))), EdgeCs[e]);
+	}
+
+	for (INT y = 0; y < Batch.m_MaxHeight; y++)
+	{
+		alignas(32) INT Offsets[8];
+		Batch.GetJitterOffsets(Target, y, Offsets);
+		const __m256i RowOffsets = _mm256_load_si256(reinterpret_cast<const __m256i*>(Offsets));
+
+		__m256 Stepped[4];
+		for (int e = 0; e < 4; e++)
+		{
+			Stepped[e] = Bases[e];
+			Bases[e] = _mm256_add_ps(Bases[e], EdgeBs[e]);
+		}
+
+		__m256i RowMask = _mm256_setzero_si256();
+		for (INT x = 0; x < Batch.m_MaxWidth; x++)
+		{
+			const __m256i Index = _mm256_add_epi32(RowOffsets, _mm256_set1_epi32(x));
+			const __m256 OffsetXs = _mm256_i32gather_ps(Target.m_JitterXs, Index, 4);
+			const __m256 OffsetYs = _mm256_i32gather_ps(Target.m_JitterYs, Index, 4);
+
+			__m256 Inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int e = 0; e < 4; e++)
+			{
+				const __m256 JitterTerm = _mm256_add_ps(_mm256_mul_ps(EdgeAs[e], OffsetXs), _mm256_mul_ps(EdgeBs[e], OffsetYs));
+				Inside = _mm256_and_ps(Inside, _mm256_cmp_ps(_mm256_add_ps(Stepped[e], JitterTerm), _mm256_setzero_ps(), _CMP_NLT_UQ));
+				Stepped[e] = _mm256_add_ps(Stepped[e], EdgeAs[e]);
+			}
+
+			RowMask = _mm256_or_si256(RowMask, _mm256_and_si256(_mm256_castps_si256(Inside), _mm256_set1_epi32(1 << x)));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(Batch.m_RowMasks[y]), RowMask);
+	}
+
+	Batch.Write(Quads, NumQuads, Target);
+}
+
+//--------------------------------------------------------------------------------------
+// Fill a uPoly a block at a time, only testing samples in blocks its edges cross.
+// Classify(XMin, YMin, XMax, YMax) says how much of a rectangle of samples the uPoly
+// covers, and Kernel(Part) fills a copy of the uPoly with a smaller rectangle, which
+// is never wider than a tile.
+//--------------------------------------------------------------------------------------
+template <class tQuad, class tClassify, class tKernel>
+void CoverByBlocks(const tQuad& Quad, const cCoverageTarget& Target, const tClassify& Classify, const tKernel& Kernel)
+{
+	// Blocks overlapping the uPoly's bounds.
+	const INT BlockXMin = Quad.XMin / CoverageBlockSize;
+	const INT BlockYMin = Quad.YMin / CoverageBlockSize;
+	const INT BlockXMax = Quad.XMax / CoverageBlockSize;
+	const INT BlockYMax = Quad.YMax / CoverageBlockSize;
+
+	// Only worth it if there can be whole blocks inside.
+	if (BlockXMax - BlockXMin < 2 || BlockYMax - BlockYMin < 2)
+	{
+		CoverInTiles(Quad, Quad.XMin, Quad.YMin, Quad.XMax, Quad.YMax, Kernel);
+		return;
+	}
+
+	for (INT by = BlockYMin; by <= BlockYMax; by++)
+	{
+		const INT YMin = Max(by * CoverageBlockSize, Quad.YMin);
+		const INT YMax = Min(by * CoverageBlockSize + CoverageBlockSize - 1, Quad.YMax);
+
+		// Classify the row of blocks, then handle runs of the same kind together so the
+		// fills and kernels get rows as long as possible.
+		eBlockCoverage RunCoverage = BlockCoverage_None;
+		INT RunXMin = Quad.XMin;
+		for (INT bx = BlockXMin; bx <= BlockXMax + 1; bx++)
+		{
+			// One past the last block finishes the last run.
+			const bool bEnd = bx > BlockXMax;
+			const INT XMin = bEnd ? Quad.XMax + 1 : Max(bx * CoverageBlockSize, Quad.XMin);
+			const INT XMax = Min(bx * CoverageBlockSize + CoverageBlockSize - 1, Quad.XMax);
+
+			const eBlockCoverage Coverage = bEnd ? BlockCoverage_None : Classify(XMin, YMin, XMax, YMax);
+			if (Coverage == RunCoverage)
+				continue;
+
+			if (RunCoverage == BlockCoverage_Full)
+			{
+				FillSamples(Target, RunXMin, YMin, XMin - 1, YMax, Quad.m_Colour);
+			}
+			else if (RunCoverage == BlockCoverage_Partial)
+			{
+				CoverInTiles(Quad, RunXMin, YMin, XMin - 1, YMax, Kernel);
+			}
+
+			RunCoverage = Coverage;
+			RunXMin = XMin;
+		}
+	}
+}
+
+}
+
+//--------------------------------------------------------------------------------------
+// Fill a uPoly by blocks, using float maths for the blocks too.
+//--------------------------------------------------------------------------------------
+void CoverQuadByBlocks(tCoverageKernel Kernel, const cCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	// Jittered samples lie in [x, x + 1] x [y, y + 1], so a block's samples lie in the
+	// block's rectangle extended by one. Each edge function is smallest at the corner
+	// the edge faces away from and largest at the opposite one.
+	const XMVECTOR Zero = XMVectorZero();
+	const XMVECTOR bPositiveA = XMVectorGreaterOrEqual(Quad.m_As, Zero);
+	const XMVECTOR bPositiveB = XMVectorGreaterOrEqual(Quad.m_Bs, Zero);
+
+	// The samples are tested with different arithmetic, so only trust a block's
+	// classification if it holds by more than the rounding error.
+	const XMVECTOR Extent = XMVectorAbs(Quad.m_As) * (float) (Quad.XMax + 1) +
+		XMVectorAbs(Quad.m_Bs) * (float) (Quad.YMax + 1) + XMVectorAbs(Quad.m_Cs);
+	const XMVECTOR Tolerance = Extent * 1.0e-5f;
+
+	auto Classify = [&](INT XMin, INT YMin, INT XMax, INT YMax) -> eBlockCoverage
+	{
+		const XMVECTOR Left = XMVectorReplicate((float) XMin);
+		const XMVECTOR Right = XMVectorReplicate((float) (XMax + 1));
+		const XMVECTOR Top = XMVectorReplicate((float) YMin);
+		const XMVECTOR Bottom = XMVectorReplicate((float) (YMax + 1));
+
+		const XMVECTOR MinValues = Quad.m_As * XMVectorSelect(Right, Left, bPositiveA) + Quad.m_Bs * XMVectorSelect(Bottom, Top, bPositiveB) - Quad.m_Cs;
+		const XMVECTOR MaxValues = Quad.m_As * XMVectorSelect(Left, Right, bPositiveA) + Quad.m_Bs * XMVectorSelect(Top, Bottom, bPositiveB) - Quad.m_Cs;
+
+		// Outside an edge everywhere, inside every edge everywhere, or neither?
+		if (_mm_movemask_ps(XMVectorLess(MaxValues, -Tolerance)))
+			return BlockCoverage_None;
+		if (!_mm_movemask_ps(XMVectorLess(MinValues, Tolerance)))
+			return BlockCoverage_Full;
+		return BlockCoverage_Partial;
+	};
+
+	CoverByBlocks(Quad, Target, Classify, [&](const cCoverageQuad& Part) { Kernel(Part, Target); });
+}
+
+//--------------------------------------------------------------------------------------
+// Fill a fixed point uPoly by blocks. The blocks are classified exactly.
+//--------------------------------------------------------------------------------------
+void CoverFixedQuadByBlocks(tFixedCoverageKernel Kernel, const cFixedCoverageQuad& Quad, const cCoverageTarget& Target)
+{
+	auto Classify = [&](INT XMin, INT YMin, INT XMax, INT YMax) -> eBlockCoverage
+	{
+		// The range of sub-sample offsets the block's samples can be at.
+		const int32_t Left = (XMin - Quad.XMin) * SubSampleScale;
+		const int32_t Right = (XMax - Quad.XMin) * SubSampleScale + SubSampleScale - 1;
+		const int32_t Top = (YMin - Quad.YMin) * SubSampleScale;
+		const int32_t Bottom = (YMax - Quad.YMin) * SubSampleScale + SubSampleScale - 1;
+
+		bool bFull = true;
+		for (int e = 0; e < 4; e++)
+		{
+			const int32_t A = Quad.m_As[e];
+			const int32_t B = Quad.m_Bs[e];
+			const int32_t MinValue = Quad.m_Es[e] + A * (A >= 0 ? Left : Right) + B * (B >= 0 ? Top : Bottom);
+			const int32_t MaxValue = Quad.m_Es[e] + A * (A >= 0 ? Right : Left) + B * (B >= 0 ? Bottom : Top);
+
+			if (MaxValue < 0)
+				return BlockCoverage_None;
+			bFull = bFull && MinValue >= 0;
+		}
+		return bFull ? BlockCoverage_Full : BlockCoverage_Partial;
+	};
+
+	CoverByBlocks(Quad, Target, Classify, [&](const cFixedCoverageQuad& Part)
+	{
+		cFixedCoverageQuad Moved = Quad;
+		Moved.SetRect(Part.XMin, Part.YMin, Part.XMax, Part.YMax);
+		Kernel(Moved, Target);
+	});
+}
+
+//--------------------------------------------------------------------------------------
+// cFixedCoverageQuad implementation.
+//--------------------------------------------------------------------------------------
+
+void cFixedCoverageQuad::SetEdges(const int32_t* As, const int32_t* Bs, const int32_t* Xs, const int32_t* Ys)
+{
+	const int32_t Left = XMin * SubSampleScale;
+	const int32_t Top = YMin * SubSampleScale;
+
+	for (int e = 0; e < 4; e++)
+	{
+		m_As[e] = As[e];
+		m_Bs[e] = Bs[e];
+
+		// Samples exactly on an edge only belong to the uPoly if it's a top or left
+		// edge, i.e. the uPoly is below or to the right of it. Edges that have
+		// collapsed to a point don't exclude anything.
+		const bool bTopLeft = As[e] > 0 || (As[e] == 0 && Bs[e] >= 0);
+		m_Es[e] = As[e] * (Left - Xs[e]) + Bs[e] * (Top - Ys[e]) - (bTopLeft ? 0 : 1);
+	}
+}
+
+void cFixedCoverageQuad::SetRect(INT NewXMin, INT NewYMin, INT NewXMax, INT NewYMax)
+{
+	for (int e = 0; e < 4; e++)
+	{
+		m_Es[e] += (m_As[e] * (NewXMin - XMin) + m_Bs[e] * (NewYMin - YMin)) * SubSampleScale;
+	}
+
+	XMin = NewXMin;
+	YMin = NewYMin;
+	XMax = NewXMax;
+	YMax = NewYMax;
+}
+
+//--------------------------------------------------------------------------------------
+// Can this CPU (and OS) run a kernel?
+//--------------------------------------------------------------------------------------
+bool IsCoverageKernelSupported(eCoverageKernel Kernel)
+{
+	switch (Kernel)
+	{
+	case CoverageKernel_SSE:	return true;
+	case CoverageKernel_AVX2:	return CPUHasAVX2();
+	case CoverageKernel_AVX512:	return CPUHasAVX512();
+	default:					return false;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// The widest kernel this CPU can run.
+//--------------------------------------------------------------------------------------
+eCoverageKernel GetBestCoverageKernel()
+{
+	static const eCoverageKernel Best =
+		IsCoverageKernelSupported(CoverageKernel_AVX512) ? CoverageKernel_AVX512 :
+		IsCoverageKernelSupported(CoverageKernel_AVX2) ? CoverageKernel_AVX2 :
+		CoverageKernel_SSE;
+	return Best;
+}
+
+tCoverageKernel GetCoverageKernel(eCoverageKernel Kernel)
+{
+	switch (Kernel)
+	{
+	case CoverageKernel_AVX2:	return CoverQuad_AVX2;
+	case CoverageKernel_AVX512:	return CoverQuad_AVX512;
+	default:					return CoverQuad_SSE;
+	}
+}
+
+tFixedCoverageKernel GetFixedCoverageKernel(eCoverageKernel Kernel)
+{
+	switch (Kernel)
+	{
+	case CoverageKernel_AVX2:	return CoverFixedQuad_AVX2;
+	case CoverageKernel_AVX512:	return CoverFixedQuad_AVX512;
+	default:					return CoverFixedQuad_SSE;
+	}
+}
+
+const char* GetCoverageKernelName(eCoverageKernel Kernel)
+{
+	switch (Kernel)
+	{
+	case CoverageKernel_AVX2:	return "AVX2";
+	case CoverageKernel_AVX512:	return "AVX-512";
+	default:					return "SSE";
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Batch kernels. AVX-512 machines use the AVX2 one; sixteen lanes of uPolys would
+// mostly be waiting on the biggest one in the batch.
+//--------------------------------------------------------------------------------------
+tCoverageBatchKernel GetCoverageBatchKernel(eCoverageKernel Kernel)
+{
+	return Kernel == CoverageKernel_SSE ? CoverQuads_SSE : CoverQuads_AVX2;
+}
+
+INT GetCoverageBatchSize(eCoverageKernel Kernel)
+{
+	return Kernel == CoverageKernel_SSE ? 4 : 8;
+}
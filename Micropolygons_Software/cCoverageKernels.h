@@ -0,0 +1,173 @@
+#pragma once
+
+//--------------------------------------------------------------------------------------
+// Coverage kernels: fill the samples a busted uPoly covers in a rectangle of the
+// super-sampled buffer. There is one per instruction set, picked at startup from what
+// the CPU supports.
+//
+// Every kernel tests the same sample positions against the same edge equations, but
+// the rounding can differ between them (the compiler is allowed to reorder the maths),
+// so a sample lying very close to an edge may come out differently. The fixed point
+// kernels don't have that problem.
+//--------------------------------------------------------------------------------------
+
+enum eCoverageKernel
+{
+	CoverageKernel_SSE,			// One sample at a time, four edges per vector.
+	CoverageKernel_AVX2,		// Eight samples at a time.
+	CoverageKernel_AVX512,		// Sixteen samples at a time.
+
+	NumCoverageKernels
+};
+
+//--------------------------------------------------------------------------------------
+// A uPoly clipped to the samples to fill.
+//--------------------------------------------------------------------------------------
+class cCoverageQuad
+{
+public:
+
+	// Edge equations: a sample is inside if A*x + B*y >= C for all four edges.
+	XMVECTOR	m_As;
+	XMVECTOR	m_Bs;
+	XMVECTOR	m_Cs;
+
+	// Sample value to write (an XMUSHORTN4).
+	uint64_t	m_Colour;
+
+	// Inclusive rectangle of screen samples to test.
+	INT			XMin, YMin, XMax, YMax;
+};
+
+//--------------------------------------------------------------------------------------
+// Fixed point: vertices and jittered sample positions are snapped to a grid of
+// sub-samples, and the edge equations are evaluated exactly with integers. Each
+// sample is owned by exactly one of the uPolys sharing an edge through it (the
+// top-left rule), and every kernel gives the same result.
+//--------------------------------------------------------------------------------------
+
+const INT SubSampleBits = 4;
+const INT SubSampleScale = 1 << SubSampleBits;
+
+// Largest extent, in sub-samples, of a uPoly that can be rasterized in fixed point
+// without the edge functions overflowing.
+const INT FixedMaxExtent = 1 << 13;
+
+//--------------------------------------------------------------------------------------
+// A fixed point uPoly clipped to the samples to fill.
+//--------------------------------------------------------------------------------------
+class alignas(16) cFixedCoverageQuad
+{
+public:
+
+	// Set the edge functions from the snapped corners: edge e runs from (Xs[e], Ys[e])
+	// with coefficients As[e] & Bs[e], all in sub-samples. Set the rectangle first.
+	void SetEdges(const int32_t* As, const int32_t* Bs, const int32_t* Xs, const int32_t* Ys);
+
+	// Move the rectangle, keeping the same edges.
+	void SetRect(INT NewXMin, INT NewYMin, INT NewXMax, INT NewYMax);
+
+	// Edge functions: the sample x sub-samples right and y down from the top-left of
+	// sample (XMin, YMin) is inside if m_Es + m_As * x + m_Bs * y >= 0 for all four
+	// edges. The fill rule is already taken into account in m_Es.
+	int32_t		m_As[4];
+	int32_t		m_Bs[4];
+	int32_t		m_Es[4];
+
+	// Sample value to write (an XMUSHORTN4).
+	uint64_t	m_Colour;
+
+	// Inclusive rectangle of screen samples to test.
+	INT			XMin, YMin, XMax, YMax;
+};
+
+//--------------------------------------------------------------------------------------
+// The super-sampled buffer is stored in square tiles of SampleTileSize samples each
+// way, each tile's rows one after another and the tiles in rows across the buffer. So
+// a pixel's samples (and below 16x, those of the few pixels around it) are together,
+// rather than spread over MSFactor rows of the screen, and a band of sample rows the
+// height of a tile is one run of memory. Tiles start at multiples of SampleTileSize
+// in screen samples, and a row of samples is only contiguous up to the end of its
+// tile. Each tile's memory is found through a table, as tiles only get memory once
+// something is drawn in them.
+//--------------------------------------------------------------------------------------
+
+const INT SampleTileSize = 16;
+
+// The last column of screen samples in the tile that column x is in.
+inline INT GetSampleTileEnd(INT x)
+{
+	return x | (SampleTileSize - 1);
+}
+
+//--------------------------------------------------------------------------------------
+// Where the kernels write, and how the sample positions are jittered.
+//--------------------------------------------------------------------------------------
+class cCoverageTarget
+{
+public:
+
+	// The super-sampled buffer's tiles, row by row, m_NumTilesX to a row. The first
+	// starts at screen sample (m_OriginX, m_OriginY). Every tile the kernels are asked
+	// to write must already have its memory.
+	uint64_t* const*	m_Tiles;
+	INT				m_OriginX, m_OriginY;
+	INT				m_NumTilesX;
+
+	// Spatial jitter, repeating every m_JitterSize samples in both directions. Each
+	// row is stored twice over (2 * m_JitterSize floats) so a run of up to
+	// m_JitterSize samples can be read without wrapping.
+	const float*	m_JitterXs;
+	const float*	m_JitterYs;
+	INT				m_JitterSize;
+
+	// The same jitter in sub-samples, for the fixed point kernels.
+	const int32_t*	m_FixedJitterXs;
+	const int32_t*	m_FixedJitterYs;
+};
+
+typedef void (*tCoverageKernel)(const cCoverageQuad& Quad, const cCoverageTarget& Target);
+typedef void (*tFixedCoverageKernel)(const cFixedCoverageQuad& Quad, const cCoverageTarget& Target);
+
+//--------------------------------------------------------------------------------------
+// Fill a uPoly block by block: blocks of samples it can't touch are skipped, blocks it
+// covers completely are filled without testing, and only the blocks its edges cross
+// are passed to Kernel. uPolys too small to have whole blocks inside just go straight
+// to Kernel.
+//--------------------------------------------------------------------------------------
+
+// Size of the blocks, in samples each way. Blocks are aligned to multiples of it.
+const INT CoverageBlockSize = 8;
+
+void CoverQuadByBlocks(tCoverageKernel Kernel, const cCoverageQuad& Quad, const cCoverageTarget& Target);
+void CoverFixedQuadByBlocks(tFixedCoverageKernel Kernel, const cFixedCoverageQuad& Quad, const cCoverageTarget& Target);
+
+//--------------------------------------------------------------------------------------
+// Batch kernels: fill several small uPolys at once, one per SIMD lane, stepping all of
+// them through the same relative sample slots together. This keeps the lanes busy
+// when each uPoly only covers a few samples, where the kernels above would spend most
+// of their time setting up. Samples are written in the order the uPolys are given.
+//--------------------------------------------------------------------------------------
+
+// Largest uPoly, in samples each way, that a batch kernel takes.
+const INT CoverageBatchMaxSize = 16;
+
+// Most uPolys any batch kernel takes at once.
+const INT CoverageBatchMaxLanes = 8;
+
+typedef void (*tCoverageBatchKernel)(const cCoverageQuad* Quads, INT NumQuads, const cCoverageTarget& Target);
+
+// Can this CPU (and OS) run a kernel?
+bool IsCoverageKernelSupported(eCoverageKernel Kernel);
+
+// The widest kernel this CPU can run. Worked out on the first call.
+eCoverageKernel GetBestCoverageKernel();
+
+tCoverageKernel GetCoverageKernel(eCoverageKernel Kernel);
+tFixedCoverageKernel GetFixedCoverageKernel(eCoverageKernel Kernel);
+
+// The batch kernel to go with a kernel, and how many uPolys it takes at once.
+tCoverageBatchKernel GetCoverageBatchKernel(eCoverageKernel Kernel);
+INT GetCoverageBatchSize(eCoverageKernel Kernel);
+
+const char* GetCoverageKernelName(eCoverageKernel Kernel);
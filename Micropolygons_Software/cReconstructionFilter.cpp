@@ -0,0 +1,109 @@
+#include "stdafx.h"
+#include "cReconstructionFilter.h"
+#include "Maths.h"
+#include <math.h>
+
+namespace
+{
+
+//--------------------------------------------------------------------------------------
+// The filters, for x in [-1,1] across the window.
+//--------------------------------------------------------------------------------------
+
+float Gaussian(float x)
+{
+	// Shifted down so the filter falls to zero at the edges of the window.
+	return Max(expf(-2.0f * x * x) - expf(-2.0f), 0.0f);
+}
+
+float Mitchell(float x)
+{
+	const float B = 1.0f / 3.0f;
+	const float C = 1.0f / 3.0f;
+
+	// The filter is usually defined over [-2,2].
+	const float t = fabsf(2.0f * x);
+	if (t < 1.0f)
+	{
+		return ((12.0f - 9.0f * B - 6.0f * C) * t * t * t +
+			(-18.0f + 12.0f * B + 6.0f * C) * t * t +
+			(6.0f - 2.0f * B)) / 6.0f;
+	}
+	if (t < 2.0f)
+	{
+		return ((-B - 6.0f * C) * t * t * t +
+			(6.0f * B + 30.0f * C) * t * t +
+			(-12.0f * B - 48.0f * C) * t +
+			(8.0f * B + 24.0f * C)) / 6.0f;
+	}
+	return 0.0f;
+}
+
+float Sinc(float x)
+{
+	return fabsf(x) < 1e-5f ? 1.0f : sinf(XM_PI * x) / (XM_PI * x);
+}
+
+float Lanczos(float x)
+{
+	const float Lobes = 3.0f;
+	return fabsf(x) < 1.0f ? Sinc(x * Lobes) * Sinc(x) : 0.0f;
+}
+
+float EvaluateFilter(eReconstructionFilter Filter, float x)
+{
+	switch (Filter)
+	{
+	case ReconstructionFilter_Gaussian:	return Gaussian(x);
+	case ReconstructionFilter_Mitchell:	return Mitchell(x);
+	case ReconstructionFilter_Lanczos:	return Lanczos(x);
+	default:							return 1.0f;
+	}
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------
+// Get a filter's name, for display.
+//--------------------------------------------------------------------------------------
+const char* GetReconstructionFilterName(eReconstructionFilter Filter)
+{
+	switch (Filter)
+	{
+	case ReconstructionFilter_Gaussian:	return "Gaussian";
+	case ReconstructionFilter_Mitchell:	return "Mitchell-Netravali";
+	case ReconstructionFilter_Lanczos:	return "Lanczos";
+	default:							return "box";
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Compute the weights. Each sample is weighted by the filter at the centre of its cell,
+// measured from the centre of the pixel.
+//--------------------------------------------------------------------------------------
+void cFilterWeights::Update(eReconstructionFilter Filter, INT MSFactor, INT Offset)
+{
+	if (Filter == m_Filter && MSFactor == m_MSFactor && Offset == m_Offset && !m_Weights.empty())
+		return;
+
+	m_Filter = Filter;
+	m_MSFactor = MSFactor;
+	m_Offset = Offset;
+
+	const INT NumTaps = MSFactor + 2 * Offset;
+	const float HalfWidth = 0.5f * (float) NumTaps;
+
+	m_Weights.resize(NumTaps);
+	float Total = 0.0f;
+	for (INT i = 0; i < NumTaps; i++)
+	{
+		const float x = ((float) i + 0.5f - HalfWidth) / HalfWidth;
+		m_Weights[i] = EvaluateFilter(Filter, x);
+		Total += m_Weights[i];
+	}
+
+	for (INT i = 0; i < NumTaps; i++)
+	{
+		m_Weights[i] /= Total;
+	}
+}
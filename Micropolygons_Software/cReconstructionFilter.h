@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+
+//--------------------------------------------------------------------------------------
+// Reconstruction filters for resolving the super-sampled buffer. Every filter is
+// separable, so the weighted ones are applied as a pass along the sample rows followed
+// by a pass down the columns, rather than weighting every sample in a 2D window.
+//--------------------------------------------------------------------------------------
+
+enum eReconstructionFilter
+{
+	ReconstructionFilter_Box,			// Unweighted average of the samples.
+	ReconstructionFilter_Gaussian,		// Standard deviation of a quarter of the width.
+	ReconstructionFilter_Mitchell,		// Mitchell-Netravali, with B = C = 1/3.
+	ReconstructionFilter_Lanczos,		// Windowed sinc with three lobes.
+
+	NumReconstructionFilters
+};
+
+const char* GetReconstructionFilterName(eReconstructionFilter Filter);
+
+//--------------------------------------------------------------------------------------
+// A filter's weights along one axis for the samples under a pixel. The window starts
+// Offset samples before the pixel's own first sample and ends Offset samples after its
+// last, and is the same for every pixel. The weights add up to one.
+//--------------------------------------------------------------------------------------
+class cFilterWeights
+{
+public:
+
+	cFilterWeights()
+		: m_Filter(ReconstructionFilter_Box)
+		, m_MSFactor(0)
+		, m_Offset(0)
+	{}
+
+	// Compute the weights, unless they're already for these settings.
+	void Update(eReconstructionFilter Filter, INT MSFactor, INT Offset);
+
+	INT GetNumTaps() const { return (INT) m_Weights.size(); }
+	const float* GetWeights() const { return &m_Weights[0]; }
+
+private:
+
+	eReconstructionFilter	m_Filter;
+	INT						m_MSFactor;
+	INT						m_Offset;
+	std::vector<float>		m_Weights;
+};
@@ -0,0 +1,186 @@
+#include "stdafx.h"
+#include "cSamplePattern.h"
+#include "Utility.h"
+
+using namespace MicropolygonCommon;
+
+namespace
+{
+
+//--------------------------------------------------------------------------------------
+// Prototype pattern for the larger multisample factors: each sample's index in the
+// pixel with its bits reversed. Like the smaller patterns, this gives every sample in
+// a pixel its own time interval, with neighbouring samples' intervals far apart.
+//--------------------------------------------------------------------------------------
+template <int MSFactor>
+const float* GetBitReversedPrototype()
+{
+	class cPrototype
+	{
+	public:
+		cPrototype()
+		{
+			const int NumSamples = MSFactor * MSFactor;
+			for (int i = 0; i < NumSamples; i++)
+			{
+				int Reversed = 0;
+				for (int Bit = 1; Bit < NumSamples; Bit <<= 1)
+				{
+					Reversed = (Reversed << 1) | ((i & Bit) ? 1 : 0);
+				}
+				m_Times[i] = (float) Reversed / (float) NumSamples;
+			}
+		}
+
+		float m_Times[MSFactor * MSFactor];
+	};
+
+	static const cPrototype Prototype;
+	return Prototype.m_Times;
+}
+
+//--------------------------------------------------------------------------------------
+// Get a prototype pattern for a given multisample factor.
+//--------------------------------------------------------------------------------------
+const float* GetPrototypeForFactor(int MSFactor)
+{
+	switch (MSFactor)
+	{
+	case 1:
+		{
+			static const float Prototype = 0.0f;
+			return &Prototype;
+		}
+		break;
+
+	case 2:
+		{
+			static const float Prototype[] = { 0.0f, 0.5f, 0.25f, 0.75f };
+			return Prototype;
+		}
+		break;
+
+	case 4:
+		{
+			// Copied from [Cook 1986].
+			static const float Prototype[] =
+			{
+				0.3750f, 0.6250f, 0.1250f, 0.8125f,
+				0.1875f, 0.8750f, 0.7500f, 0.5000f,
+				0.9375f, 0.0000f, 0.4375f, 0.6875f,
+				0.3125f, 0.5625f, 0.2500f, 0.0625f,
+			};
+			return Prototype;
+		}
+		break;
+
+	case 8:
+		return GetBitReversedPrototype<8>();
+
+	case 16:
+		return GetBitReversedPrototype<16>();
+
+	default:
+		_ASSERT(0);
+		return NULL;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// A random number in [0, 1) for one of a sample's jitter channels, hashed from its
+// position so the tables come out the same however and whenever they're built.
+//--------------------------------------------------------------------------------------
+enum eJitterChannel
+{
+	JitterChannel_X,
+	JitterChannel_Y,
+	JitterChannel_Time,
+};
+
+float HashJitter(INT MSFactor, INT x, INT y, eJitterChannel Channel)
+{
+	uint32_t Hash = (uint32_t) x * 0x8da6b343u ^ (uint32_t) y * 0xd8163841u ^
+		(uint32_t) (MSFactor * 3 + Channel) * 0xcb1ab31fu;
+	Hash ^= Hash >> 16;
+	Hash *= 0x7feb352du;
+	Hash ^= Hash >> 15;
+	Hash *= 0x846ca68bu;
+	Hash ^= Hash >> 16;
+
+	// Keep 24 bits so the result converts exactly and stays below 1.
+	return (float) (Hash >> 8) * (1.0f / (float) (1 << 24));
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------
+// Build the pattern for a multisample factor.
+//--------------------------------------------------------------------------------------
+cSamplePattern::cSamplePattern(INT MSFactor)
+	: m_MSFactor(MSFactor)
+	, m_Size(PatternSizePixels * MSFactor)
+	, m_Prototype(GetPrototypeForFactor(MSFactor))
+{
+	const INT TableSize = m_Size * m_Size;
+	m_Jitter = AlignedAlloc<XMVECTOR>(TableSize);
+	m_JitterXs = AlignedAlloc<float>(2 * TableSize);
+	m_JitterYs = AlignedAlloc<float>(2 * TableSize);
+	m_FixedJitterXs = AlignedAlloc<int32_t>(2 * TableSize);
+	m_FixedJitterYs = AlignedAlloc<int32_t>(2 * TableSize);
+
+	// Spatial jitter is a random offset within the sample's cell. Temporal jitter is a
+	// random time within the interval the prototype gives the sample.
+	const float Interval = 1.0f / (float) (MSFactor * MSFactor);
+	for (INT y = 0; y < m_Size; y++)
+	{
+		for (INT x = 0; x < m_Size; x++)
+		{
+			const float t = m_Prototype[(y % MSFactor) * MSFactor + x % MSFactor] +
+				HashJitter(MSFactor, x, y, JitterChannel_Time) * Interval;
+			m_Jitter[y * m_Size + x] = XMVectorSet(
+				HashJitter(MSFactor, x, y, JitterChannel_X),
+				HashJitter(MSFactor, x, y, JitterChannel_Y),
+				t, 0.0f);
+		}
+	}
+
+	// Split out the spatial jitter, doubling up the rows, and snap it to sub-samples.
+	for (INT y = 0; y < m_Size; y++)
+	{
+		for (INT x = 0; x < 2 * m_Size; x++)
+		{
+			const XMVECTOR Jitter = m_Jitter[y * m_Size + x % m_Size];
+			const INT i = y * 2 * m_Size + x;
+			m_JitterXs[i] = XMVectorGetX(Jitter);
+			m_JitterYs[i] = XMVectorGetY(Jitter);
+			m_FixedJitterXs[i] = (int32_t) (m_JitterXs[i] * SubSampleScale);
+			m_FixedJitterYs[i] = (int32_t) (m_JitterYs[i] * SubSampleScale);
+		}
+	}
+}
+
+cSamplePattern::~cSamplePattern()
+{
+	AlignedFree(m_Jitter);
+	AlignedFree(m_JitterXs);
+	AlignedFree(m_JitterYs);
+	AlignedFree(m_FixedJitterXs);
+	AlignedFree(m_FixedJitterYs);
+}
+
+//--------------------------------------------------------------------------------------
+// Get the pattern for a multisample factor. Function-local statics are built once, on
+// first use, even when several threads ask at the same time.
+//--------------------------------------------------------------------------------------
+const cSamplePattern* cSamplePattern::Get(INT MSFactor)
+{
+	switch (MSFactor)
+	{
+	case 1:		{ static const cSamplePattern Pattern(1);	return &Pattern; }
+	case 2:		{ static const cSamplePattern Pattern(2);	return &Pattern; }
+	case 4:		{ static const cSamplePattern Pattern(4);	return &Pattern; }
+	case 8:		{ static const cSamplePattern Pattern(8);	return &Pattern; }
+	case 16:	{ static const cSamplePattern Pattern(16);	return &Pattern; }
+	default:	return NULL;
+	}
+}
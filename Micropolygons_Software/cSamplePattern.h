@@ -0,0 +1,75 @@
+#pragma once
+
+#include "cCoverageKernels.h"
+
+//--------------------------------------------------------------------------------------
+// Where each sample of the super-sampled buffer sits inside its sample cell, and at
+// what time in the frame, for one multisample factor. The pattern repeats every
+// PatternSizePixels pixels in both directions so that sampling is coherent from frame
+// to frame.
+//
+// Samples are stratified in space (one per sample cell, jittered within it) and in time
+// (each sample of a pixel gets its own interval of the prototype, jittered within it).
+// Every value is a fixed function of the sample's position in the pattern, so the
+// tables don't depend on what else the program is doing.
+//
+// There is one pattern per supported factor. Each is built the first time it's asked
+// for and never changes after that, so any number of rasterizers can share it from any
+// thread.
+//--------------------------------------------------------------------------------------
+class cSamplePattern
+{
+public:
+
+	enum { PatternSizePixels = 32 };
+
+	// Get the pattern for a multisample factor, or NULL if the factor isn't supported.
+	static const cSamplePattern* Get(INT MSFactor);
+
+	INT GetMSFactor() const { return m_MSFactor; }
+
+	// Number of samples before the pattern repeats, in each direction.
+	INT GetSize() const { return m_Size; }
+
+	// Jitter for the samples in row y of the screen, repeating every GetSize(). x & y
+	// are the spatial offsets and z the time.
+	const XMVECTOR* GetRow(INT y) const { return m_Jitter + (y % m_Size) * m_Size; }
+
+	// Start of each time interval, for the samples of a pixel in row-major order. The
+	// intervals are 1 / (MSFactor * MSFactor) long.
+	const float* GetPrototype() const { return m_Prototype; }
+
+	// Point the coverage kernels at the spatial jitter.
+	void SetTargetJitter(cCoverageTarget& Target) const
+	{
+		Target.m_JitterXs = m_JitterXs;
+		Target.m_JitterYs = m_JitterYs;
+		Target.m_JitterSize = m_Size;
+		Target.m_FixedJitterXs = m_FixedJitterXs;
+		Target.m_FixedJitterYs = m_FixedJitterYs;
+	}
+
+	~cSamplePattern();
+
+private:
+
+	explicit cSamplePattern(INT MSFactor);
+
+	cSamplePattern(const cSamplePattern&);
+	cSamplePattern& operator=(const cSamplePattern&);
+
+	INT				m_MSFactor;
+	INT				m_Size;
+
+	const float*	m_Prototype;
+
+	// m_Size * m_Size samples, row by row.
+	XMVECTOR*		m_Jitter;
+
+	// The spatial jitter again as separate x & y tables for the coverage kernels, with
+	// each row stored twice over (see cCoverageTarget), in floats and sub-samples.
+	float*			m_JitterXs;
+	float*			m_JitterYs;
+	int32_t*		m_FixedJitterXs;
+	int32_t*		m_FixedJitterYs;
+};
@@ -2,73 +2,50 @@
 #include "cSoftwareRasterizer.h"
 #include "cGrid.h"
 #include "Utility.h"
+#include "cTaskScheduler.h"
+#include "cLinearArena.h"
+#include <vector>
+#include <cfloat>
 
 #define USE_SSE 1
 
 #if USE_SSE
 #include <xmmintrin.h>
+#ifdef _MSC_VER
 #include <fvec.h>
 #endif
+#endif
 
 using namespace MicropolygonCommon;
+using namespace std;
 
 namespace
 {
 
+// Size of the screen tiles that are rasterized in parallel.
+const INT TileSizePixels = 32;
+
+// Grain sizes for the parallel loops: grid rows per bust task, and pixel rows per
+// resolve task.
+const INT BustGrain = 4;
+const INT ResolveGrain = 8;
+
+// Width of the chunks, in samples, that each band of rows is resolved in.
+const INT ResolveChunkSamples = 1024;
+
+// Grids whose uPolys average this many pixels across or less are sampled in batches of
+// uPolys rather than one at a time.
+const float SmallQuadPixels = 2.0f;
+
 //--------------------------------------------------------------------------------------
 // A set of four edge equations.
 // 16-byte aligned to allow SSE usage.
 //--------------------------------------------------------------------------------------
-__declspec(align(16)) class cFourEquations
+class alignas(16) cFourEquations
 {
 public:
 	cFourEquations() {}
 
-	void Set(const XMVECTOR* points)
-	{
-		const int IndexLookup[] = {0,1,3,2};
-		for (int i = 0; i < 4; i++)
-		{
-			const auto& p0 = points[IndexLookup[i]];
-			const auto& p1 = points[IndexLookup[(i+1) % 4]];
-
-			const float p0_x = XMVectorGetX(p0);
-			const float p0_y = XMVectorGetY(p0);
-			const float p1_x = XMVectorGetX(p1);
-			const float p1_y = XMVectorGetY(p1);
-
-			const float A = p1_y - p0_y;
-			const float B = p0_x - p1_x;
-			const float C = A * p0_x + B * p0_y;
-
-			As = XMVectorSetByIndex(As, A, i);
-			Bs = XMVectorSetByIndex(Bs, B, i);
-			Cs = XMVectorSetByIndex(Cs, C, i);
-		}
-	}
-	void Set(const XMVECTOR* points, float Scalar)
-	{
-		const int IndexLookup[] = {0,1,3,2};
-		for (int i = 0; i < 4; i++)
-		{
-			const auto& p0 = points[IndexLookup[i]] * Scalar;
-			const auto& p1 = points[IndexLookup[(i + 1) % 4]] * Scalar;
-
-			const float p0_x = XMVectorGetX(p0);
-			const float p0_y = XMVectorGetY(p0);
-			const float p1_x = XMVectorGetX(p1);
-			const float p1_y = XMVectorGetY(p1);
-
-			const float A = p1_y - p0_y;
-			const float B = p0_x - p1_x;
-			const float C = A * p0_x + B * p0_y;
-
-			As = XMVectorSetByIndex(As, A, i);
-			Bs = XMVectorSetByIndex(Bs, B, i);
-			Cs = XMVectorSetByIndex(Cs, C, i);
-		}
-	}
-
 	// The coefficients of the equations.
 	// Note we use the form Ax + By = C, so C is negated from the canonical form.
 	XMVECTOR	As;
@@ -77,159 +54,389 @@ public:
 };
 
 //--------------------------------------------------------------------------------------
-// Intermediate micropolygon data structure.
+// The four edge equations of a uPoly whose corners move in straight lines over the
+// frame. A & B are linear in time and C quadratic, so at time t the equations are
+//   (As + t*dAs) x + (Bs + t*dBs) y = Cs + t*dCs + t*t*ddCs.
 //--------------------------------------------------------------------------------------
-class cIntermediateQuadNoBlur
+class alignas(16) cMovingEquations
 {
 public:
+	cMovingEquations() {}
 
-	cFourEquations	m_EdgeEquations;
-	XMUSHORTN4		m_Colour;					// Single colour (no Gouraud)
-	INT				XMin, XMax, YMin, YMax;		// Conservative extents of the screen-space AABB.
+	XMVECTOR	As;
+	XMVECTOR	Bs;
+	XMVECTOR	Cs;
+	XMVECTOR	dAs;
+	XMVECTOR	dBs;
+	XMVECTOR	dCs;
+	XMVECTOR	ddCs;
 };
 
 //--------------------------------------------------------------------------------------
-// Intermediate micropolygon data structure for motion blur case.
+// Intermediate micropolygon data structure for motion blur case, shared by all of the
+// uPoly's time intervals.
 //--------------------------------------------------------------------------------------
 class cIntermediateQuadMotionBlur
 {
 public:
 
-	cFourEquations	m_EdgeEquations[2];			// t0 and t1
-	XMUSHORTN4		m_Colour;					// Single colour (no Gouraud)
-	INT				XMin, XMax, YMin, YMax;		// Conservative extents of the screen-space AABB.
+	cMovingEquations	m_EdgeEquations;
+	XMUSHORTN4			m_Colour;					// Single colour (no Gouraud)
 };
 
 //--------------------------------------------------------------------------------------
-// Get a prototype pattern for a given multisample factor.
+// A uPoly on one of the time intervals, i.e. the samples at one position in each pixel.
 //--------------------------------------------------------------------------------------
-float* GetPrototype(int MSFactor)
+class cMotionBlurInterval
 {
-	switch (MSFactor)
-	{
-	case 1:
-		{
-			static float Prototype = 0.0f;
-			return &Prototype;
-		}
-		break;
+public:
 
-	case 2:
-		{
-			static float Prototype[] = { 0.0f, 0.5f, 0.25f, 0.75f };
-			return Prototype;
-		}
-		break;
+	INT		m_Quad;						// Index of the uPoly's cIntermediateQuadMotionBlur.
+	INT		XMin, XMax, YMin, YMax;		// Samples on the interval the uPoly can reach.
+};
 
-	case 4:
-		{
-			// Copied from [Cook 1986].
-			static float Prototype[] =
-			{
-				0.3750f, 0.6250f, 0.1250f, 0.8125f,
-				0.1875f, 0.8750f, 0.7500f, 0.5000f,
-				0.9375f, 0.0000f, 0.4375f, 0.6875f,
-				0.3125f, 0.5625f, 0.2500f, 0.0625f,
-			};
-			return Prototype;
-		}
-		break;
+//--------------------------------------------------------------------------------------
+// Test a sample against 4 edges in parallel, given the values of the edge functions
+// (A*x + B*y - C) at the sample.
+//--------------------------------------------------------------------------------------
+inline bool IsInsideFourEdges(FXMVECTOR Values)
+{
+// IsInside <=> A*x + B*y > C;
 
-	default:
-		// TODO
-		_ASSERT(0);
-		return NULL;
-	}
+#if USE_SSE
+
+	return !_mm_movemask_ps(XMVectorLess(Values, XMVectorZero()));
+
+#else
+
+	return XMVector4GreaterOrEqual(Values, XMVectorZero());
+
+#endif
 }
 
 //--------------------------------------------------------------------------------------
-// Functions for testing 4 edge equations in parallel.
+// Move Value up in whole steps until it is at least Lower.
 //--------------------------------------------------------------------------------------
+inline INT StepUpTo(INT Value, INT Lower, INT Step)
+{
+	return Value < Lower ? Value + (Lower - Value + Step - 1) / Step * Step : Value;
+}
 
-#if USE_SSE
+//--------------------------------------------------------------------------------------
+// Round Value up or down to the nearest number that is Offset more than a multiple of
+// Step, which must be a power of two.
+//--------------------------------------------------------------------------------------
+inline INT RoundUpToOffset(INT Value, INT Offset, INT Step)
+{
+	return Value + ((Offset - Value) & (Step - 1));
+}
+inline INT RoundDownToOffset(INT Value, INT Offset, INT Step)
+{
+	return Value - ((Value - Offset) & (Step - 1));
+}
 
-bool IsInsideFourEqns_SSE(FXMVECTOR a, FXMVECTOR b, FXMVECTOR c, FXMVECTOR xy)
+//--------------------------------------------------------------------------------------
+// Busting four uPolys at once.
+//
+// The uPolys sit side by side along a grid row, one per lane. Corner 0 & 1 run along
+// the top edge and 2 & 3 along the bottom, as in the grid.
+//--------------------------------------------------------------------------------------
+
+// Load the pixel-space corners of the four uPolys starting at Index in a grid of
+// projected vertices (see ProjectGridVerts).
+void LoadFourQuadCorners(const float* Xs, const float* Ys, INT Index, INT RowStride, XMVECTOR* CornerXs, XMVECTOR* CornerYs)
 {
-	auto x = XMVectorSplatX(xy);
-	auto y = XMVectorSplatY(xy);
+	const INT Offsets[4] = { 0, 1, RowStride, RowStride + 1 };
+	for (int i = 0; i < 4; i++)
+	{
+		CornerXs[i] = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(Xs + Index + Offsets[i]));
+		CornerYs[i] = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(Ys + Index + Offsets[i]));
+	}
+}
 
-	// Compute LHS of inequality.
-	XMVECTOR lhs = a * x + b * y;
+// Compute the edge equations of the four uPolys. Writes each uPoly's coefficients, in
+// the form cFourEquations uses, to As[i], Bs[i] and Cs[i].
+void BustFourEdgeEquations(const XMVECTOR* CornerXs, const XMVECTOR* CornerYs, XMVECTOR* As, XMVECTOR* Bs, XMVECTOR* Cs)
+{
+	// Going round each uPoly, one edge per row of the matrices.
+	const int IndexLookup[] = {0,1,3,2};
+	XMMATRIX EdgeAs, EdgeBs, EdgeCs;
+	for (int i = 0; i < 4; i++)
+	{
+		const int p0 = IndexLookup[i];
+		const int p1 = IndexLookup[(i + 1) % 4];
 
-	// Compare LHS & RHS.
-	XMVECTOR Comparison = XMVectorLess(lhs, c);
+		EdgeAs.r[i] = CornerYs[p1] - CornerYs[p0];
+		EdgeBs.r[i] = CornerXs[p0] - CornerXs[p1];
+		EdgeCs.r[i] = EdgeAs.r[i] * CornerXs[p0] + EdgeBs.r[i] * CornerYs[p0];
+	}
 
-	// Extract result.
-	int Mask = _mm_movemask_ps(Comparison);
-	return !Mask;
+	// Transpose to one uPoly per row.
+	EdgeAs = XMMatrixTranspose(EdgeAs);
+	EdgeBs = XMMatrixTranspose(EdgeBs);
+	EdgeCs = XMMatrixTranspose(EdgeCs);
+	for (int i = 0; i < 4; i++)
+	{
+		As[i] = EdgeAs.r[i];
+		Bs[i] = EdgeBs.r[i];
+		Cs[i] = EdgeCs.r[i];
+	}
 }
 
-XMVECTOR LerpSSE(FXMVECTOR X, FXMVECTOR Y, FXMVECTOR alpha)
+// Compute the edge equations of the four uPolys as they move from their corners at the
+// start of the frame (CornerXs[0] & CornerYs[0]) to their corners at the end
+// (CornerXs[1] & CornerYs[1]). Writes each uPoly's equations to Equations[i].
+void BustFourMovingEdgeEquations(const XMVECTOR (*CornerXs)[4], const XMVECTOR (*CornerYs)[4], cMovingEquations* Equations)
 {
-	return X + alpha * (Y - X);
+	// Going round each uPoly, one edge per row of the matrices.
+	const int IndexLookup[] = {0,1,3,2};
+	XMMATRIX EdgeAs, EdgeBs, EdgeCs, EdgedAs, EdgedBs, EdgedCs, EdgeddCs;
+	for (int i = 0; i < 4; i++)
+	{
+		const int p0 = IndexLookup[i];
+		const int p1 = IndexLookup[(i + 1) % 4];
+
+		// The edge starts from (X0, Y0) + t * (VX0, VY0). Since it always goes
+		// through there, C(t) = A(t) * X0(t) + B(t) * Y0(t).
+		const XMVECTOR X0 = CornerXs[0][p0];
+		const XMVECTOR Y0 = CornerYs[0][p0];
+		const XMVECTOR VX0 = CornerXs[1][p0] - X0;
+		const XMVECTOR VY0 = CornerYs[1][p0] - Y0;
+
+		EdgeAs.r[i] = CornerYs[0][p1] - Y0;
+		EdgeBs.r[i] = X0 - CornerXs[0][p1];
+		EdgedAs.r[i] = (CornerYs[1][p1] - CornerYs[1][p0]) - EdgeAs.r[i];
+		EdgedBs.r[i] = (CornerXs[1][p0] - CornerXs[1][p1]) - EdgeBs.r[i];
+
+		EdgeCs.r[i] = EdgeAs.r[i] * X0 + EdgeBs.r[i] * Y0;
+		EdgedCs.r[i] = EdgeAs.r[i] * VX0 + EdgedAs.r[i] * X0 + EdgeBs.r[i] * VY0 + EdgedBs.r[i] * Y0;
+		EdgeddCs.r[i] = EdgedAs.r[i] * VX0 + EdgedBs.r[i] * VY0;
+	}
+
+	// Transpose to one uPoly per row.
+	EdgeAs = XMMatrixTranspose(EdgeAs);
+	EdgeBs = XMMatrixTranspose(EdgeBs);
+	EdgeCs = XMMatrixTranspose(EdgeCs);
+	EdgedAs = XMMatrixTranspose(EdgedAs);
+	EdgedBs = XMMatrixTranspose(EdgedBs);
+	EdgedCs = XMMatrixTranspose(EdgedCs);
+	EdgeddCs = XMMatrixTranspose(EdgeddCs);
+	for (int i = 0; i < 4; i++)
+	{
+		Equations[i].As = EdgeAs.r[i];
+		Equations[i].Bs = EdgeBs.r[i];
+		Equations[i].Cs = EdgeCs.r[i];
+		Equations[i].dAs = EdgedAs.r[i];
+		Equations[i].dBs = EdgedBs.r[i];
+		Equations[i].dCs = EdgedCs.r[i];
+		Equations[i].ddCs = EdgeddCs.r[i];
+	}
 }
 
+// Per-lane integer min & max.
+XMVECTOR MinInt(FXMVECTOR a, FXMVECTOR b)
+{
+#if USE_SSE
+	const __m128i ai = _mm_castps_si128(a);
+	const __m128i bi = _mm_castps_si128(b);
+	const __m128i Greater = _mm_cmpgt_epi32(ai, bi);
+	return _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(Greater, bi), _mm_andnot_si128(Greater, ai)));
+#else
+	XMVECTOR Result;
+	for (int i = 0; i < 4; i++)
+		Result.m128_i32[i] = Min(a.m128_i32[i], b.m128_i32[i]);
+	return Result;
 #endif
+}
 
-bool IsInsideFourEquations(const cFourEquations& Eqns, FXMVECTOR XY)
+XMVECTOR MaxInt(FXMVECTOR a, FXMVECTOR b)
 {
-// IsInside <=> A*x + B*y > C;
-
 #if USE_SSE
-
-	return IsInsideFourEqns_SSE(Eqns.As, Eqns.Bs, Eqns.Cs, XY);
-
+	const __m128i ai = _mm_castps_si128(a);
+	const __m128i bi = _mm_castps_si128(b);
+	const __m128i Greater = _mm_cmpgt_epi32(ai, bi);
+	return _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(Greater, ai), _mm_andnot_si128(Greater, bi)));
 #else
+	XMVECTOR Result;
 	for (int i = 0; i < 4; i++)
+		Result.m128_i32[i] = Max(a.m128_i32[i], b.m128_i32[i]);
+	return Result;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Busted uPolys without motion blur, as separate streams. Laid out like the grid's
+// vertices, so the uPoly with top-left corner (x, y) is at y * GetRowStride() + x.
+// uPolys with empty bounds cover no samples in the buffer.
+//--------------------------------------------------------------------------------------
+class cBustedQuads
+{
+public:
+
+	cBustedQuads(const cGrid& Grid, bool bFixedPoint, cLinearArena& Arena)
 	{
-		if (Eqns.As[i] * X + Eqns.Bs[i] * Y <= Eqns.Cs[i])
+		const size_t Count = Grid.GetNumPolysY() * Grid.GetRowStride();
+		m_As = Arena.Alloc<XMVECTOR>(Count);
+		m_Bs = Arena.Alloc<XMVECTOR>(Count);
+		m_Cs = Arena.Alloc<XMVECTOR>(Count);
+		for (int i = 0; i < 4; i++)
 		{
-			return false;
+			m_Bounds[i] = static_cast<INT*>(Arena.Alloc(Count * sizeof(INT), 16));
 		}
+
+		m_bFixed = NULL;
+		for (int i = 0; i < 4; i++)
+		{
+			m_FixedEdges[i] = NULL;
+		}
+		if (bFixedPoint)
+		{
+			m_bFixed = static_cast<INT*>(Arena.Alloc(Count * sizeof(INT), 16));
+			for (int i = 0; i < 4; i++)
+			{
+				m_FixedEdges[i] = Arena.Alloc<XMVECTOR>(Count);
+			}
+		}
+
+		// Single colour (no Gouraud), taken from the first vert, so the grid's own
+		// colours will do.
+		m_Colours = Grid.GetColourRow(0);
 	}
 
-	return true;
-#endif
-}
+	// Edge equation coefficients, as in cFourEquations.
+	XMVECTOR*	m_As;
+	XMVECTOR*	m_Bs;
+	XMVECTOR*	m_Cs;
 
-bool IsInsideFourTimeDependentEqns(const cFourEquations& Eqns_t0, const cFourEquations& Eqns_t1, FXMVECTOR XYT)
-{
-#if USE_SSE
+	// Clamped inclusive sample bounds: XMin, YMin, XMax, YMax.
+	INT*		m_Bounds[4];
 
-	// Lerp the two equation sets.
-	__m128 t = XMVectorSplatZ(XYT);
+	// Fixed point edges, only when rasterizing in fixed point: the integer As, Bs and
+	// start Xs & Ys of each uPoly's edges, as cFixedCoverageQuad::SetEdges takes. They
+	// are only valid where m_bFixed is non-zero; the rest of the uPolys are too big
+	// for fixed point and use the float equations.
+	INT*		m_bFixed;
+	XMVECTOR*	m_FixedEdges[4];
+
+	const XMUSHORTN4*	m_Colours;
+};
+
+// Compute the fixed point edges of the four uPolys for cBustedQuads, snapping their
+// corners to sub-samples. The snapped corners are whole numbers well within float
+// precision, so the edges can be worked out exactly as floats before converting.
+void BustFourFixedEdges(const XMVECTOR* CornerXs, const XMVECTOR* CornerYs, INT Index, cBustedQuads& Quads)
+{
+	const XMVECTOR Scale = XMVectorReplicate((float) SubSampleScale);
+	XMVECTOR Xs[4], Ys[4];
+	for (int i = 0; i < 4; i++)
+	{
+		Xs[i] = XMVectorRound(CornerXs[i] * Scale);
+		Ys[i] = XMVectorRound(CornerYs[i] * Scale);
+	}
 
-	__m128 a = LerpSSE(Eqns_t0.As, Eqns_t1.As, t);
-	__m128 b = LerpSSE(Eqns_t0.Bs, Eqns_t1.Bs, t);
-	__m128 c = LerpSSE(Eqns_t0.Cs, Eqns_t1.Cs, t);
+	// Only uPolys small enough not to overflow can use fixed point. NaNs and infinities
+	// fail the tests too.
+	const XMVECTOR MaxExtent = XMVectorReplicate((float) FixedMaxExtent);
+	const XMVECTOR MaxPosition = XMVectorReplicate((float) (1 << 22));
+	XMVECTOR bFixed = XMVectorEqual(Xs[0], Xs[0]);
+	for (int Axis = 0; Axis < 2; Axis++)
+	{
+		const XMVECTOR* c = Axis == 0 ? Xs : Ys;
+		const XMVECTOR Lower = XMVectorMin(XMVectorMin(c[0], c[1]), XMVectorMin(c[2], c[3]));
+		const XMVECTOR Upper = XMVectorMax(XMVectorMax(c[0], c[1]), XMVectorMax(c[2], c[3]));
 
-	// Compute the inequality.
-	return IsInsideFourEqns_SSE(a, b, c, XYT);
+		bFixed = XMVectorAndInt(bFixed, XMVectorLessOrEqual(Upper - Lower, MaxExtent));
+		bFixed = XMVectorAndInt(bFixed, XMVectorLessOrEqual(XMVectorAbs(Lower), MaxPosition));
+		bFixed = XMVectorAndInt(bFixed, XMVectorLessOrEqual(XMVectorAbs(Upper), MaxPosition));
+	}
+	XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(Quads.m_bFixed + Index), bFixed);
 
-#else
+	// Going round each uPoly as in BustFourEdgeEquations, one edge per row.
+	const int IndexLookup[] = {0,1,3,2};
+	XMMATRIX Edges[4];
 	for (int i = 0; i < 4; i++)
 	{
-		// Lerp coefficients
-		float A = Lerp(Eqns_t0.As[i], Eqns_t1.As[i], T);
-		float B = Lerp(Eqns_t0.Bs[i], Eqns_t1.Bs[i], T);
-		float C = Lerp(Eqns_t0.Cs[i], Eqns_t1.Cs[i], T);
+		const int p0 = IndexLookup[i];
+		const int p1 = IndexLookup[(i + 1) % 4];
+
+		Edges[0].r[i] = Ys[p1] - Ys[p0];
+		Edges[1].r[i] = Xs[p0] - Xs[p1];
+		Edges[2].r[i] = Xs[p0];
+		Edges[3].r[i] = Ys[p0];
+	}
 
-		// Compute inequality
-		if (A * X + B * Y <= C)
+	// Transpose to one uPoly per row.
+	for (int j = 0; j < 4; j++)
+	{
+		Edges[j] = XMMatrixTranspose(Edges[j]);
+		for (int i = 0; i < 4; i++)
 		{
-			return false;
+			Quads.m_FixedEdges[j][Index + i] = XMConvertVectorFloatToInt(Edges[j].r[i], 0);
 		}
 	}
-
-	return true;
-#endif
 }
 
-}
+//--------------------------------------------------------------------------------------
+// Lists of the micropolygons overlapping each screen tile. Tiles don't share any
+// samples, so they can be rasterized in parallel without locking, and as each list is
+// kept in submission order the result doesn't depend on how the work is scheduled.
+//--------------------------------------------------------------------------------------
+class cTileBins
+{
+public:
+
+	// Cover the inclusive sample rectangle with tiles of TileSize samples square.
+	cTileBins(INT XMin, INT YMin, INT XMax, INT YMax, INT TileSize)
+		: m_XMin(XMin)
+		, m_YMin(YMin)
+		, m_XMax(XMax)
+		, m_YMax(YMax)
+		, m_TileSize(TileSize)
+		, m_NumTilesX((XMax - XMin) / TileSize + 1)
+		, m_NumTilesY((YMax - YMin) / TileSize + 1)
+		, m_Bins(m_NumTilesX * m_NumTilesY)
+	{}
+
+	// Add a micropolygon to every tile its bounds overlap.
+	// The bounds must already be clamped to the rectangle.
+	void Add(INT XMin, INT YMin, INT XMax, INT YMax, INT Index)
+	{
+		const INT TileXMin = (XMin - m_XMin) / m_TileSize;
+		const INT TileYMin = (YMin - m_YMin) / m_TileSize;
+		const INT TileXMax = (XMax - m_XMin) / m_TileSize;
+		const INT TileYMax = (YMax - m_YMin) / m_TileSize;
+
+		for (INT ty = TileYMin; ty <= TileYMax; ty++)
+		{
+			for (INT tx = TileXMin; tx <= TileXMax; tx++)
+			{
+				m_Bins[ty * m_NumTilesX + tx].push_back(Index);
+			}
+		}
+	}
+
+	INT GetNumTiles() const { return m_NumTilesX * m_NumTilesY; }
+	const vector<INT>& GetBin(INT Tile) const { return m_Bins[Tile]; }
+
+	// Get the inclusive sample rectangle of a tile.
+	void GetTileRect(INT Tile, INT& XMin, INT& YMin, INT& XMax, INT& YMax) const
+	{
+		XMin = m_XMin + (Tile % m_NumTilesX) * m_TileSize;
+		YMin = m_YMin + (Tile / m_NumTilesX) * m_TileSize;
+		XMax = Min(XMin + m_TileSize - 1, m_XMax);
+		YMax = Min(YMin + m_TileSize - 1, m_YMax);
+	}
+
+private:
+
+	INT		m_XMin, m_YMin, m_XMax, m_YMax;
+	INT		m_TileSize;
+	INT		m_NumTilesX, m_NumTilesY;
 
-// Static members.
-XMVECTOR*	cSoftwareRasterizer::sm_JitterLookup = NULL;
-int			cSoftwareRasterizer::sm_JitterLookupMSFactor = 0;
+	vector< vector<INT> >	m_Bins;
+};
+
+}
 
 inline bool MatrixEqual(const XMMATRIX& a, const FXMMATRIX& b)
 {
@@ -245,425 +452,1059 @@ inline bool MatrixEqual(const XMMATRIX& a, const FXMMATRIX& b)
 //--------------------------------------------------------------------------------------
 void cSoftwareRasterizer::RasterizeGrid(const cGrid& Grid)
 {
-	if (sm_JitterLookupMSFactor != m_MSFactor)
+	// Outside of a bucket, grids are rendered to the whole screen.
+	if (!m_bInBucket && m_bScreenNeedsClear)
 	{
-		InitJitterLookup(m_MSFactor);
+		PrepareScreenBuffer();
 	}
 
-	// Clear render target.
-	ZeroMemory(m_MSBuffer, m_Width * m_Height * m_MSFactor * m_MSFactor * sizeof(*m_MSBuffer));
-
 	// Decide between the two rasterization methods.
 	const bool bMotionBlur = !MatrixEqual(Grid.GetTransform(), Grid.GetPrevTransform());
 	if (!bMotionBlur)
-		RasterizeGridStandard(Grid);
+		(this->*m_MSFunctions->m_RasterizeGridStandard)(Grid);
 	else
-		RasterizeGridMotionBlur(Grid);
+		(this->*m_MSFunctions->m_RasterizeGridMotionBlur)(Grid);
+}
 
-	DownsampleBuffer();
+//--------------------------------------------------------------------------------------
+// Set the target and sampling parameters.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::SetParameters(UINT Width, UINT Height, INT MSFactor, float FilterWidth, void* TargetPixels,
+	eTargetFormat TargetFormat)
+{
+	m_Width = Width;
+	m_Height = Height;
+	m_MSFactor = MSFactor;
+	m_MSFilterWidth = (INT) (FilterWidth * MSFactor);
+	m_TargetPixels = TargetPixels;
+	m_TargetFormat = TargetFormat;
+
+	m_MSFunctions = GetMSFunctions(MSFactor);
+	m_SamplePattern = cSamplePattern::Get(MSFactor);
+	_ASSERTE(m_MSFunctions && m_SamplePattern);
 }
 
 //--------------------------------------------------------------------------------------
-// Rasterize a normal grid that does not have motion blur.
+// Get the functions specialised for a multisample factor, or NULL if it isn't
+// supported.
 //--------------------------------------------------------------------------------------
-void cSoftwareRasterizer::RasterizeGridStandard(const cGrid& Grid)
+const cSoftwareRasterizer::cMSFunctions* cSoftwareRasterizer::GetMSFunctions(INT MSFactor)
 {
-	// Compute screen-space AABB and edge equations for each uPoly.
-	auto* IntQuads = AlignedAlloc<cIntermediateQuadNoBlur>(Grid.GetNumPolysX() * Grid.GetNumPolysY());
-	INT NumIntQuads = 0;
+	static const cMSFunctions Functions[] =
+	{
+		MakeMSFunctions<1>(),
+		MakeMSFunctions<2>(),
+		MakeMSFunctions<4>(),
+		MakeMSFunctions<8>(),
+		MakeMSFunctions<16>(),
+	};
 
-	// Bust each uPoly in the grid.
-	for (INT y = 0; y < Grid.GetNumPolysY(); y++)
+	switch (MSFactor)
 	{
-		for (INT x = 0; x < Grid.GetNumPolysX(); x++)
-		{
-			cIntermediateQuadNoBlur OutQuad;
+	case 1:		return &Functions[0];
+	case 2:		return &Functions[1];
+	case 4:		return &Functions[2];
+	case 8:		return &Functions[3];
+	case 16:	return &Functions[4];
+	default:	return NULL;
+	}
+}
 
-			// Transform verts to perspective space.
-			XMVECTOR PerspectivePositions[4];
-			PerspectivePositions[0] = XMVector3TransformCoord(Grid.GetVert(x    , y    ).GetPos(), Grid.GetTransform());
-			PerspectivePositions[1] = XMVector3TransformCoord(Grid.GetVert(x + 1, y    ).GetPos(), Grid.GetTransform());
-			PerspectivePositions[2] = XMVector3TransformCoord(Grid.GetVert(x    , y + 1).GetPos(), Grid.GetTransform());
-			PerspectivePositions[3] = XMVector3TransformCoord(Grid.GetVert(x + 1, y + 1).GetPos(), Grid.GetTransform());
+template <INT MSFactor>
+cSoftwareRasterizer::cMSFunctions cSoftwareRasterizer::MakeMSFunctions()
+{
+	cMSFunctions Functions;
+	Functions.m_RasterizeGridStandard = &cSoftwareRasterizer::RasterizeGridStandard<MSFactor>;
+	Functions.m_RasterizeGridMotionBlur = &cSoftwareRasterizer::RasterizeGridMotionBlur<MSFactor>;
+	Functions.m_DownsampleBuffer = &cSoftwareRasterizer::DownsampleBuffer<MSFactor>;
+	return Functions;
+}
 
-			// Convert perspective positions to pixel space.
-			XMVECTOR PixelPositions[4] =
-			{
-				ToMSPixelVert(PerspectivePositions[0]),
-				ToMSPixelVert(PerspectivePositions[1]),
-				ToMSPixelVert(PerspectivePositions[2]),
-				ToMSPixelVert(PerspectivePositions[3])
-			};
-
-			// Calculate conservative pixel-space bounds.
-			OutQuad.XMin = (INT) floor(XMVectorGetX(PixelPositions[0]));
-			OutQuad.YMin = (INT) floor(XMVectorGetY(PixelPositions[0]));
-			OutQuad.XMax = (INT) ceil(XMVectorGetX(PixelPositions[0]));
-			OutQuad.YMax = (INT) ceil(XMVectorGetY(PixelPositions[0]));
-
-			for (int i = 1; i < 4; i++)
-			{
-				OutQuad.XMin = Min(OutQuad.XMin, (INT) floor(XMVectorGetX(PixelPositions[i])));
-				OutQuad.YMin = Min(OutQuad.YMin, (INT) floor(XMVectorGetY(PixelPositions[i])));
-				OutQuad.XMax = Max(OutQuad.XMax, (INT) ceil(XMVectorGetX(PixelPositions[i])));
-				OutQuad.YMax = Max(OutQuad.YMax, (INT) ceil(XMVectorGetY(PixelPositions[i])));
-			}
+//--------------------------------------------------------------------------------------
+// Start a frame. The buffer is cleared when the first grid arrives, as buckets bring
+// their own.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::BeginFrame()
+{
+	m_bScreenNeedsClear = true;
+	m_bScreenUsed = false;
 
-			// Discard polys completely off screen.
-			if (OutQuad.XMax < 0 || OutQuad.XMin >= (INT) m_Width * m_MSFactor ||
-				OutQuad.YMax < 0 || OutQuad.YMin >= (INT) m_Height * m_MSFactor)
-			{
-				continue;
-			}
+	m_FilterWeights.Update(m_ReconstructionFilter, m_MSFactor, GetFilterOffset());
+}
 
-			// Clamp min & max to screen bounds to avoid worrying about it later.
-			OutQuad.XMin = Max(OutQuad.XMin, 0);
-			OutQuad.YMin = Max(OutQuad.YMin, 0);
-			OutQuad.XMax = Min(OutQuad.XMax, (INT) m_Width * m_MSFactor - 1);
-			OutQuad.YMax = Min(OutQuad.YMax, (INT) m_Height * m_MSFactor - 1);
+//--------------------------------------------------------------------------------------
+// Finish a frame, resolving whatever full-screen rendering dirtied.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::EndFrame()
+{
+	_ASSERTE(!m_bInBucket);
 
-			// Copy colour of first vert.
-			OutQuad.m_Colour = Grid.GetVert(x, y).colour;
+	if (m_bScreenUsed && m_DirtyXMin <= m_DirtyXMax && m_DirtyYMin <= m_DirtyYMax)
+	{
+		// Resolve every pixel whose filter reads a dirty sample.
+		const INT Offset = GetFilterOffset();
+		(this->*m_MSFunctions->m_DownsampleBuffer)(
+			Max((m_DirtyXMin - Offset) / m_MSFactor - 1, 0),
+			Max((m_DirtyYMin - Offset) / m_MSFactor - 1, 0),
+			Min((m_DirtyXMax + Offset) / m_MSFactor + 2, (INT) m_Width),
+			Min((m_DirtyYMax + Offset) / m_MSFactor + 2, (INT) m_Height));
+	}
 
-			// Compute edge equations.
-			OutQuad.m_EdgeEquations.Set(PixelPositions);
+	m_bScreenNeedsClear = false;
+}
 
-			// Add the resulting quad to the intermediate list.
-			IntQuads[NumIntQuads++] = OutQuad;
+//--------------------------------------------------------------------------------------
+// Get the buffer ready for the first full-screen grid of a frame.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::PrepareScreenBuffer()
+{
+	const INT XMax = m_Width * m_MSFactor - 1;
+	const INT YMax = m_Height * m_MSFactor - 1;
+
+	if (m_BufferXMin != 0 || m_BufferYMin != 0 || m_BufferXMax != XMax || m_BufferYMax != YMax)
+	{
+		// Buckets or a resize have been at it, so start again.
+		SetBufferRegion(0, 0, XMax, YMax);
+	}
+	else if (m_DirtyXMin <= m_DirtyXMax && m_DirtyYMin <= m_DirtyYMax)
+	{
+		// Only the tiles the last frame drew in can have memory, and they're all in the
+		// dirty rectangle. Mark them untouched again and hand their memory back.
+		const INT TileXMin = (m_DirtyXMin - m_BufferOriginX) / SampleTileSize;
+		const INT TileYMin = (m_DirtyYMin - m_BufferOriginY) / SampleTileSize;
+		const INT TileXMax = (m_DirtyXMax - m_BufferOriginX) / SampleTileSize;
+		const INT TileYMax = (m_DirtyYMax - m_BufferOriginY) / SampleTileSize;
+		for (INT TileY = TileYMin; TileY <= TileYMax; TileY++)
+		{
+			tRenderTargetFormat** Row = &m_Tiles[TileY * m_NumTilesX];
+			std::fill(Row + TileXMin, Row + TileXMax + 1, (tRenderTargetFormat*) NULL);
 		}
+		m_NumPoolTilesUsed = 0;
 	}
 
-	const int bufferStride = m_Width * m_MSFactor;
+	m_DirtyXMin = m_DirtyYMin = INT_MAX;
+	m_DirtyXMax = m_DirtyYMax = INT_MIN;
+
+	m_bScreenNeedsClear = false;
+	m_bScreenUsed = true;
+}
+
+//--------------------------------------------------------------------------------------
+// Grow the dirty rectangle to include some samples.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::AddDirtyRect(INT XMin, INT YMin, INT XMax, INT YMax)
+{
+	m_DirtyXMin = Min(m_DirtyXMin, XMin);
+	m_DirtyYMin = Min(m_DirtyYMin, YMin);
+	m_DirtyXMax = Max(m_DirtyXMax, XMax);
+	m_DirtyYMax = Max(m_DirtyYMax, YMax);
+}
+
+//--------------------------------------------------------------------------------------
+// Start a new bucket. Only the samples the bucket's pixels are filtered from are kept.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::BeginBucket(int XMin, int YMin, int XMax, int YMax)
+{
+	_ASSERTE(!m_bInBucket);
+	m_bInBucket = true;
+
+	m_BucketXMin = XMin;
+	m_BucketYMin = YMin;
+	m_BucketXMax = XMax;
+	m_BucketYMax = YMax;
+
+	const INT Offset = GetFilterOffset();
+	SetBufferRegion(
+		Max(XMin * m_MSFactor - Offset, 0),
+		Max(YMin * m_MSFactor - Offset, 0),
+		Min(XMax * m_MSFactor + Offset, (INT) m_Width * m_MSFactor) - 1,
+		Min(YMax * m_MSFactor + Offset, (INT) m_Height * m_MSFactor) - 1);
+}
+
+//--------------------------------------------------------------------------------------
+// Finish the current bucket, resolving it to the target.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::EndBucket()
+{
+	_ASSERTE(m_bInBucket);
+	m_bInBucket = false;
 
-	// Rasterize each uPoly.
-	for (INT nPoly = 0; nPoly < NumIntQuads; nPoly++)
+	(this->*m_MSFunctions->m_DownsampleBuffer)(m_BucketXMin, m_BucketYMin, m_BucketXMax, m_BucketYMax);
+}
+
+//--------------------------------------------------------------------------------------
+// Number of pixels outside a bucket whose samples the filter reads.
+//--------------------------------------------------------------------------------------
+int cSoftwareRasterizer::GetBucketMargin() const
+{
+	return (GetFilterOffset() + m_MSFactor - 1) / m_MSFactor;
+}
+
+//--------------------------------------------------------------------------------------
+// Point the super-sampled buffer at a region of the screen and clear it. The pool has
+// room for every tile, but only the tiles drawn in are ever written.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::SetBufferRegion(INT XMin, INT YMin, INT XMax, INT YMax)
+{
+	m_BufferXMin = XMin;
+	m_BufferYMin = YMin;
+	m_BufferXMax = XMax;
+	m_BufferYMax = YMax;
+
+	// Whole tiles, the first starting at or before (XMin, YMin).
+	m_BufferOriginX = XMin & ~(SampleTileSize - 1);
+	m_BufferOriginY = YMin & ~(SampleTileSize - 1);
+	m_NumTilesX = (XMax - m_BufferOriginX) / SampleTileSize + 1;
+	m_NumTilesY = (YMax - m_BufferOriginY) / SampleTileSize + 1;
+
+	const INT NumTiles = m_NumTilesX * m_NumTilesY;
+	if (NumTiles > m_TilePoolCapacity)
 	{
-		const cIntermediateQuadNoBlur& Quad = IntQuads[nPoly];
+		AlignedFree(m_TilePool);
+		m_TilePool = AlignedAlloc<tRenderTargetFormat>((size_t) NumTiles * SampleTileSize * SampleTileSize);
+		m_TilePoolCapacity = NumTiles;
+	}
 
-		XMVECTOR vxMin = XMConvertVectorIntToFloat(XMVectorSetInt(Quad.XMin, 0, 0, 0), 0);
-		XMVECTOR vy = XMConvertVectorIntToFloat(XMVectorSetInt(0, Quad.YMin, 0, 0), 0);
-		XMVECTOR xAdd = XMVectorSetX(XMVectorZero(), 1.0f);
-		XMVECTOR yAdd = XMVectorSetY(XMVectorZero(), 1.0f);
+	m_Tiles.assign(NumTiles, NULL);
+	m_NumPoolTilesUsed = 0;
+}
 
-		auto* destBase = m_MSBuffer + Quad.YMin * bufferStride + Quad.XMin;
+//--------------------------------------------------------------------------------------
+// Give memory, cleared, to each tile that a rectangle of samples overlaps, if it hasn't
+// any yet. Tiles can be allocated by several threads at once, but each tile is only
+// drawn in by one (see cTileBins), so just the pool needs to be shared safely.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::AllocateTiles(INT XMin, INT YMin, INT XMax, INT YMax)
+{
+	const INT TileXMin = (XMin - m_BufferOriginX) / SampleTileSize;
+	const INT TileYMin = (YMin - m_BufferOriginY) / SampleTileSize;
+	const INT TileXMax = (XMax - m_BufferOriginX) / SampleTileSize;
+	const INT TileYMax = (YMax - m_BufferOriginY) / SampleTileSize;
 
-		for (INT Y = Quad.YMin; Y <= Quad.YMax; Y++, vy += yAdd)
+	for (INT TileY = TileYMin; TileY <= TileYMax; TileY++)
+	{
+		for (INT TileX = TileXMin; TileX <= TileXMax; TileX++)
 		{
-			auto vx = vxMin;
-			auto* dest = destBase;
-
-			for (INT X = Quad.XMin; X <= Quad.XMax; X++, vx += xAdd)
+			tRenderTargetFormat*& Tile = m_Tiles[TileY * m_NumTilesX + TileX];
+			if (!Tile)
 			{
-				auto xy = XMVectorOrInt(vx, vy);
-				xy += GetJitter(xy);
+				const INT PoolIndex = m_NumPoolTilesUsed++;
+				_ASSERTE(PoolIndex < m_TilePoolCapacity);
+				Tile = m_TilePool + (size_t) PoolIndex * SampleTileSize * SampleTileSize;
+				ZeroMemory(Tile, SampleTileSize * SampleTileSize * sizeof(*Tile));
+			}
+		}
+	}
+}
 
-				// Test sample location against edge equations.
-				if (IsInsideFourEquations(Quad.m_EdgeEquations, xy))
-				{
-					// Force it to use the uint64_t assignment operator
-					// to avoid copying component-wise.
-					*dest = Quad.m_Colour.v;
-				}
+//--------------------------------------------------------------------------------------
+// Are all of a rectangle of samples in untouched tiles?
+//--------------------------------------------------------------------------------------
+bool cSoftwareRasterizer::IsUntouched(INT XMin, INT YMin, INT XMax, INT YMax) const
+{
+	const INT TileXMin = (XMin - m_BufferOriginX) / SampleTileSize;
+	const INT TileYMin = (YMin - m_BufferOriginY) / SampleTileSize;
+	const INT TileXMax = (XMax - m_BufferOriginX) / SampleTileSize;
+	const INT TileYMax = (YMax - m_BufferOriginY) / SampleTileSize;
 
-				dest++;
+	for (INT TileY = TileYMin; TileY <= TileYMax; TileY++)
+	{
+		for (INT TileX = TileXMin; TileX <= TileXMax; TileX++)
+		{
+			if (m_Tiles[TileY * m_NumTilesX + TileX])
+			{
+				return false;
 			}
-
-			destBase += bufferStride;
 		}
 	}
+	return true;
+}
 
-	AlignedFree(IntQuads);
+//--------------------------------------------------------------------------------------
+// Transform every vertex of a grid to pixel space, multi-sampled or not. Returns the
+// x & y coordinates in separate arrays laid out like the grid's vertices, GetRowStride()
+// per row, allocated from Arena. There are four spare zeros on the end so the busting
+// can read a full vector past the last vertex.
+//--------------------------------------------------------------------------------------
+void cSoftwareRasterizer::ProjectGridVerts(const cGrid& Grid, CXMMATRIX Transform, bool bMultiSampled, cLinearArena& Arena,
+	float*& PixelXs, float*& PixelYs)
+{
+	const INT RowStride = Grid.GetRowStride();
+	const INT NumVertsY = Grid.GetNumPolysY() + 1;
+	const INT NumVerts = RowStride * NumVertsY;
+
+	PixelXs = static_cast<float*>(Arena.Alloc((NumVerts + 4) * sizeof(float), 16));
+	PixelYs = static_cast<float*>(Arena.Alloc((NumVerts + 4) * sizeof(float), 16));
+	XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(PixelXs + NumVerts), XMVectorZero());
+	XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(PixelYs + NumVerts), XMVectorZero());
+
+	// Only x, y & w of the transformed position are needed. Splat the matrix elements
+	// that produce them so four vertices can be done at once.
+	XMFLOAT4X4 M;
+	XMStoreFloat4x4(&M, Transform);
+	const XMVECTOR Mx[4] = { XMVectorReplicate(M._11), XMVectorReplicate(M._21), XMVectorReplicate(M._31), XMVectorReplicate(M._41) };
+	const XMVECTOR My[4] = { XMVectorReplicate(M._12), XMVectorReplicate(M._22), XMVectorReplicate(M._32), XMVectorReplicate(M._42) };
+	const XMVECTOR Mw[4] = { XMVectorReplicate(M._14), XMVectorReplicate(M._24), XMVectorReplicate(M._34), XMVectorReplicate(M._44) };
+
+	// Perspective to pixel space, as in ToMSPixelVert & ToPixelVert.
+	const float Scale = bMultiSampled ? 0.5f * m_MSFactor : 0.5f;
+	const XMVECTOR ScaleX = XMVectorReplicate(Scale * (float) m_Width);
+	const XMVECTOR ScaleY = XMVectorReplicate(Scale * -(float) m_Height);
+	const XMVECTOR BiasX = XMVectorReplicate(Scale * (float) m_Width);
+	const XMVECTOR BiasY = XMVectorReplicate(Scale * (float) m_Height);
+
+	cTaskScheduler::Instance().ParallelFor(NumVertsY, BustGrain, [&](int RowBegin, int RowEnd)
+	{
+		for (INT y = RowBegin; y < RowEnd; y++)
+		{
+			const float* Xs = Grid.GetXRow(y);
+			const float* Ys = Grid.GetYRow(y);
+			const float* Zs = Grid.GetZRow(y);
+			float* OutXs = PixelXs + y * RowStride;
+			float* OutYs = PixelYs + y * RowStride;
+
+			// Whole rows including the padding, four vertices at a time.
+			for (INT x = 0; x < RowStride; x += 4)
+			{
+				const XMVECTOR X = XMLoadFloat4A(reinterpret_cast<const XMFLOAT4A*>(Xs + x));
+				const XMVECTOR Y = XMLoadFloat4A(reinterpret_cast<const XMFLOAT4A*>(Ys + x));
+				const XMVECTOR Z = XMLoadFloat4A(reinterpret_cast<const XMFLOAT4A*>(Zs + x));
+
+				// Transform to perspective space.
+				const XMVECTOR W = XMVectorMultiplyAdd(X, Mw[0], XMVectorMultiplyAdd(Y, Mw[1], XMVectorMultiplyAdd(Z, Mw[2], Mw[3])));
+				const XMVECTOR PerspX = XMVectorMultiplyAdd(X, Mx[0], XMVectorMultiplyAdd(Y, Mx[1], XMVectorMultiplyAdd(Z, Mx[2], Mx[3]))) / W;
+				const XMVECTOR PerspY = XMVectorMultiplyAdd(X, My[0], XMVectorMultiplyAdd(Y, My[1], XMVectorMultiplyAdd(Z, My[2], My[3]))) / W;
+
+				// Then to pixel space.
+				XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(OutXs + x), XMVectorMultiplyAdd(PerspX, ScaleX, BiasX));
+				XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(OutYs + x), XMVectorMultiplyAdd(PerspY, ScaleY, BiasY));
+			}
+		}
+	});
 }
 
 //--------------------------------------------------------------------------------------
-// Rasterize a grid that has large amounts of motion blur.
+// Rasterize a normal grid that does not have motion blur.
+//
+// Rows of the grid are busted in parallel, then the micropolygons are sorted into
+// screen tiles which are sampled in parallel.
 //--------------------------------------------------------------------------------------
-void cSoftwareRasterizer::RasterizeGridMotionBlur(const cGrid& Grid)
+template <INT MSFactor>
+void cSoftwareRasterizer::RasterizeGridStandard(const cGrid& Grid)
 {
+	// Temporary buffers only last for this call, so come off the top of the frame arena.
+	cLinearArena& Arena = cFrameArenas::Instance().GetThreadArena();
+	cArenaScope ArenaScope(Arena);
+
+	// Transform and project each grid vertex once, rather than once per uPoly using it.
+	float* PixelXs;
+	float* PixelYs;
+	ProjectGridVerts(Grid, Grid.GetTransform(), true, Arena, PixelXs, PixelYs);
+	const INT RowStride = Grid.GetRowStride();
+
 	// Compute screen-space AABB and edge equations for each uPoly.
-	auto* IntQuads = AlignedAlloc<cIntermediateQuadMotionBlur>(
-		Grid.GetNumPolysX() * Grid.GetNumPolysY() * m_MSFactor * m_MSFactor);
-	INT NumIntQuads = 0;
+	cBustedQuads Quads(Grid, m_bFixedPoint, Arena);
 
-	// Bust each uPoly in the grid.
-	for (INT y = 0; y < Grid.GetNumPolysY(); y++)
+	const XMVECTOR BufferMin[2] = { XMVectorReplicateInt(m_BufferXMin), XMVectorReplicateInt(m_BufferYMin) };
+	const XMVECTOR BufferMax[2] = { XMVectorReplicateInt(m_BufferXMax), XMVectorReplicateInt(m_BufferYMax) };
+
+	// Bust the uPolys in the grid four at a time. The last few in each row may run
+	// into the padding, which is harmless as nothing reads them.
+	cTaskScheduler::Instance().ParallelFor(Grid.GetNumPolysY(), BustGrain, [&](int RowBegin, int RowEnd)
 	{
-		for (INT x = 0; x < Grid.GetNumPolysX(); x++)
+		for (INT y = RowBegin; y < RowEnd; y++)
 		{
-			// Transform verts to perspective space.
-			XMVECTOR PerspectivePositions[4];
-			PerspectivePositions[0] = XMVector3TransformCoord(Grid.GetVert(x    , y    ).GetPos(), Grid.GetTransform());
-			PerspectivePositions[1] = XMVector3TransformCoord(Grid.GetVert(x + 1, y    ).GetPos(), Grid.GetTransform());
-			PerspectivePositions[2] = XMVector3TransformCoord(Grid.GetVert(x    , y + 1).GetPos(), Grid.GetTransform());
-			PerspectivePositions[3] = XMVector3TransformCoord(Grid.GetVert(x + 1, y + 1).GetPos(), Grid.GetTransform());
-
-			// Do the same for the previous positions.
-			XMVECTOR PrevPerspectivePositions[4];
-			PrevPerspectivePositions[0] = XMVector3TransformCoord(Grid.GetVert(x    , y    ).GetPos(), Grid.GetPrevTransform());
-			PrevPerspectivePositions[1] = XMVector3TransformCoord(Grid.GetVert(x + 1, y    ).GetPos(), Grid.GetPrevTransform());
-			PrevPerspectivePositions[2] = XMVector3TransformCoord(Grid.GetVert(x    , y + 1).GetPos(), Grid.GetPrevTransform());
-			PrevPerspectivePositions[3] = XMVector3TransformCoord(Grid.GetVert(x + 1, y + 1).GetPos(), Grid.GetPrevTransform());
-
-			// Convert perspective positions (current and previous) to pixel space (non multisampled).
-			XMVECTOR PixelPositions[4] =
+			for (INT x = 0; x < Grid.GetNumPolysX(); x += 4)
 			{
-				ToPixelVert(PerspectivePositions[0]),
-				ToPixelVert(PerspectivePositions[1]),
-				ToPixelVert(PerspectivePositions[2]),
-				ToPixelVert(PerspectivePositions[3])
-			};
-			XMVECTOR PrevPixelPositions[4] =
+				const INT Index = y * RowStride + x;
+
+				XMVECTOR Corners[2][4];
+				LoadFourQuadCorners(PixelXs, PixelYs, Index, RowStride, Corners[0], Corners[1]);
+
+				// Calculate conservative pixel-space bounds, clamped to the buffer. Polys
+				// completely outside the buffer end up with empty bounds.
+				for (int Axis = 0; Axis < 2; Axis++)
+				{
+					const XMVECTOR* c = Corners[Axis];
+					const XMVECTOR Lower = XMVectorMin(XMVectorMin(c[0], c[1]), XMVectorMin(c[2], c[3]));
+					const XMVECTOR Upper = XMVectorMax(XMVectorMax(c[0], c[1]), XMVectorMax(c[2], c[3]));
+
+					const XMVECTOR BoundMin = MaxInt(XMConvertVectorFloatToInt(XMVectorFloor(Lower), 0), BufferMin[Axis]);
+					const XMVECTOR BoundMax = MinInt(XMConvertVectorFloatToInt(XMVectorCeiling(Upper), 0), BufferMax[Axis]);
+
+					XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(Quads.m_Bounds[Axis] + Index), BoundMin);
+					XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(Quads.m_Bounds[Axis + 2] + Index), BoundMax);
+				}
+
+				// Compute edge equations.
+				BustFourEdgeEquations(Corners[0], Corners[1], Quads.m_As + Index, Quads.m_Bs + Index, Quads.m_Cs + Index);
+				if (m_bFixedPoint)
+				{
+					BustFourFixedEdges(Corners[0], Corners[1], Index, Quads);
+				}
+			}
+		}
+	});
+
+	// Sort the uPolys into tiles, keeping them in grid order.
+	cTileBins Bins(m_BufferOriginX, m_BufferOriginY, m_BufferXMax, m_BufferYMax, TileSizePixels * MSFactor);
+	INT NumBinned = 0;
+	INT TotalExtent = 0;
+	for (INT y = 0; y < Grid.GetNumPolysY(); y++)
+	{
+		for (INT i = y * RowStride; i < y * RowStride + Grid.GetNumPolysX(); i++)
+		{
+			const INT XMin = Quads.m_Bounds[0][i];
+			const INT YMin = Quads.m_Bounds[1][i];
+			const INT XMax = Quads.m_Bounds[2][i];
+			const INT YMax = Quads.m_Bounds[3][i];
+			if (XMin <= XMax && YMin <= YMax)
 			{
-				ToPixelVert(PrevPerspectivePositions[0]),
-				ToPixelVert(PrevPerspectivePositions[1]),
-				ToPixelVert(PrevPerspectivePositions[2]),
-				ToPixelVert(PrevPerspectivePositions[3])
-			};
-
-			// Compute edge equations.
-			// Edge equations must be in sub-pixel space so multiply by ms-factor.
-			cFourEquations EdgeEquations[2];
-			EdgeEquations[0].Set(PrevPixelPositions, (float) m_MSFactor);
-			EdgeEquations[1].Set(PixelPositions, (float) m_MSFactor);
-
-			const float* Prototype = GetPrototype(m_MSFactor);
-
-			// Process each time sub-sample interval.
-			for (int py = 0; py < m_MSFactor; py++)
+				Bins.Add(XMin, YMin, XMax, YMax, i);
+				AddDirtyRect(XMin, YMin, XMax, YMax);
+
+				NumBinned++;
+				TotalExtent += (XMax - XMin + 1) + (YMax - YMin + 1);
+			}
+		}
+	}
+
+	// Tiny uPolys only cover a few samples each, so go through them a batch at a time.
+	// Any that are too big for a batch are still done on their own. There are no fixed
+	// point batch kernels.
+	const bool bBatched = !m_bFixedPoint && NumBinned > 0 &&
+		TotalExtent <= 2.0f * NumBinned * SmallQuadPixels * MSFactor;
+	const tCoverageBatchKernel CoverQuads = GetCoverageBatchKernel(m_CoverageKernel);
+	const INT BatchSize = GetCoverageBatchSize(m_CoverageKernel);
+
+	// Rasterize each tile's uPolys.
+	const tCoverageKernel CoverQuad = ::GetCoverageKernel(m_CoverageKernel);
+	const tFixedCoverageKernel CoverFixedQuad = GetFixedCoverageKernel(m_CoverageKernel);
+
+	cCoverageTarget Target;
+	Target.m_Tiles = reinterpret_cast<uint64_t* const*>(&m_Tiles[0]);
+	Target.m_OriginX = m_BufferOriginX;
+	Target.m_OriginY = m_BufferOriginY;
+	Target.m_NumTilesX = m_NumTilesX;
+	m_SamplePattern->SetTargetJitter(Target);
+
+	cTaskScheduler::Instance().ParallelFor(Bins.GetNumTiles(), 1, [&](int TileBegin, int TileEnd)
+	{
+		for (INT Tile = TileBegin; Tile < TileEnd; Tile++)
+		{
+			INT TileXMin, TileYMin, TileXMax, TileYMax;
+			Bins.GetTileRect(Tile, TileXMin, TileYMin, TileXMax, TileYMax);
+
+			cCoverageQuad Batch[CoverageBatchMaxLanes];
+			INT NumBatched = 0;
+
+			const vector<INT>& Bin = Bins.GetBin(Tile);
+			for (vector<INT>::const_iterator it = Bin.begin(); it != Bin.end(); ++it)
 			{
-				for (int px = 0; px < m_MSFactor; px++)
+				const INT Index = *it;
+
+				cCoverageQuad& Quad = Batch[NumBatched];
+				Quad.m_As = Quads.m_As[Index];
+				Quad.m_Bs = Quads.m_Bs[Index];
+				Quad.m_Cs = Quads.m_Cs[Index];
+				Quad.m_Colour = Quads.m_Colours[Index].v;
+
+				// Only touch the samples in this tile.
+				Quad.XMin = Max(Quads.m_Bounds[0][Index], TileXMin);
+				Quad.YMin = Max(Quads.m_Bounds[1][Index], TileYMin);
+				Quad.XMax = Min(Quads.m_Bounds[2][Index], TileXMax);
+				Quad.YMax = Min(Quads.m_Bounds[3][Index], TileYMax);
+				AllocateTiles(Quad.XMin, Quad.YMin, Quad.XMax, Quad.YMax);
+
+				if (m_bFixedPoint && Quads.m_bFixed[Index])
 				{
-					const float tMin = Prototype[py*m_MSFactor + px];
-					const float tMax = tMin + 1.0f / (float) (m_MSFactor*m_MSFactor);
+					cFixedCoverageQuad FixedQuad;
+					FixedQuad.m_Colour = Quad.m_Colour;
+					FixedQuad.XMin = Quad.XMin;
+					FixedQuad.YMin = Quad.YMin;
+					FixedQuad.XMax = Quad.XMax;
+					FixedQuad.YMax = Quad.YMax;
+					FixedQuad.SetEdges(
+						reinterpret_cast<const int32_t*>(Quads.m_FixedEdges[0] + Index),
+						reinterpret_cast<const int32_t*>(Quads.m_FixedEdges[1] + Index),
+						reinterpret_cast<const int32_t*>(Quads.m_FixedEdges[2] + Index),
+						reinterpret_cast<const int32_t*>(Quads.m_FixedEdges[3] + Index));
+
+					CoverFixedQuadByBlocks(CoverFixedQuad, FixedQuad, Target);
+					continue;
+				}
 
-					// Interpolate postions.
-					XMVECTOR TMinPixelPositions[4];
-					XMVECTOR TMaxPixelPositions[4];
-					for (int i = 0; i < 4; i++)
+				const bool bFitsBatch =
+					Quad.XMax - Quad.XMin < CoverageBatchMaxSize &&
+					Quad.YMax - Quad.YMin < CoverageBatchMaxSize;
+				if (bBatched && bFitsBatch)
+				{
+					if (++NumBatched == BatchSize)
 					{
-						TMinPixelPositions[i] = Lerp(PrevPixelPositions[i], PixelPositions[i], tMin);
-						TMaxPixelPositions[i] = Lerp(PrevPixelPositions[i], PixelPositions[i], tMax);
+						CoverQuads(Batch, NumBatched, Target);
+						NumBatched = 0;
 					}
+					continue;
+				}
 
-					cIntermediateQuadMotionBlur OutQuad;
+				// Finish the batch first to keep the uPolys in order.
+				if (NumBatched > 0)
+				{
+					CoverQuads(Batch, NumBatched, Target);
+					Batch[0] = Quad;
+					NumBatched = 0;
+				}
+				CoverQuadByBlocks(CoverQuad, Batch[0], Target);
+			}
 
-					// Calculate conservative pixel-space bounds.
-					OutQuad.XMin = INT_MAX; OutQuad.YMin = INT_MAX;
-					OutQuad.XMax = INT_MIN; OutQuad.YMax = INT_MIN;
+			if (NumBatched > 0)
+			{
+				CoverQuads(Batch, NumBatched, Target);
+			}
+		}
+	});
+}
 
-					for (int i = 0; i < 4; i++)
-					{
-						OutQuad.XMin = Min(OutQuad.XMin, (int) floor(XMVectorGetX(TMinPixelPositions[i])));
-						OutQuad.YMin = Min(OutQuad.YMin, (int) floor(XMVectorGetY(TMinPixelPositions[i])));
-						OutQuad.XMin = Min(OutQuad.XMin, (int) floor(XMVectorGetX(TMaxPixelPositions[i])));
-						OutQuad.YMin = Min(OutQuad.YMin, (int) floor(XMVectorGetY(TMaxPixelPositions[i])));
-
-						OutQuad.XMax = Max(OutQuad.XMax, (int) ceil(XMVectorGetX(TMinPixelPositions[i])));
-						OutQuad.YMax = Max(OutQuad.YMax, (int) ceil(XMVectorGetY(TMinPixelPositions[i])));
-						OutQuad.XMax = Max(OutQuad.XMax, (int) ceil(XMVectorGetX(TMaxPixelPositions[i])));
-						OutQuad.YMax = Max(OutQuad.YMax, (int) ceil(XMVectorGetY(TMaxPixelPositions[i])));
-					}
+//--------------------------------------------------------------------------------------
+// Rasterize a grid that has large amounts of motion blur.
+//
+// Each sample position in a pixel has its own interval of the frame to sample (see
+// cSamplePattern), so each uPoly is rasterized once per interval, testing only the
+// samples at that position which lie within its bounds over the interval. The corners
+// move in straight lines, so those bounds are just the bounds of the corners at either
+// end of the interval.
+//
+// Parallelised the same way as RasterizeGridStandard.
+//--------------------------------------------------------------------------------------
+template <INT MSFactor>
+void cSoftwareRasterizer::RasterizeGridMotionBlur(const cGrid& Grid)
+{
+	// Temporary buffers only last for this call, so come off the top of the frame arena.
+	cLinearArena& Arena = cFrameArenas::Instance().GetThreadArena();
+	cArenaScope ArenaScope(Arena);
+
+	// Transform and project each grid vertex once for each end of the frame, rather
+	// than once per uPoly using it.
+	float* PixelXs[2];
+	float* PixelYs[2];
+	ProjectGridVerts(Grid, Grid.GetPrevTransform(), true, Arena, PixelXs[0], PixelYs[0]);
+	ProjectGridVerts(Grid, Grid.GetTransform(), true, Arena, PixelXs[1], PixelYs[1]);
+	const INT RowStride = Grid.GetRowStride();
+
+	// Compute the edge equations for each uPoly, and its bounds on each time interval.
+	// The equations are stored once per uPoly, and each row of the grid gets its own
+	// run of the intervals.
+	const INT NumIntervals = MSFactor * MSFactor;
+	const INT IntervalsPerRow = Grid.GetNumPolysX() * NumIntervals;
+	auto* IntQuads = Arena.Alloc<cIntermediateQuadMotionBlur>(Grid.GetNumPolysY() * Grid.GetNumPolysX());
+	auto* Intervals = Arena.Alloc<cMotionBlurInterval>(Grid.GetNumPolysY() * IntervalsPerRow);
+	auto* NumRowIntervals = Arena.Alloc<INT>(Grid.GetNumPolysY());
+
+	const float* Prototype = m_SamplePattern->GetPrototype();
+
+	// Bounds are clamped to just outside the buffer before converting to integers.
+	const XMVECTOR BoundsMin = XMVectorReplicate((float) (m_BufferXMin - MSFactor));
+	const XMVECTOR BoundsMax = XMVectorReplicate((float) (m_BufferXMax + MSFactor));
+	const XMVECTOR BoundsMinY = XMVectorReplicate((float) (m_BufferYMin - MSFactor));
+	const XMVECTOR BoundsMaxY = XMVectorReplicate((float) (m_BufferYMax + MSFactor));
 
-					// Adjust so it represents the min & max sub-samples that this time sample can occupy.
-					OutQuad.XMin = OutQuad.XMin * m_MSFactor + px;
-					OutQuad.YMin = OutQuad.YMin * m_MSFactor + py;
-					OutQuad.XMax = OutQuad.XMax * m_MSFactor + px;
-					OutQuad.YMax = OutQuad.YMax * m_MSFactor + py;
+	// Bust each uPoly in the grid.
+	cTaskScheduler::Instance().ParallelFor(Grid.GetNumPolysY(), BustGrain, [&](int RowBegin, int RowEnd)
+	{
+		for (INT y = RowBegin; y < RowEnd; y++)
+		{
+			auto* RowIntervals = Intervals + y * IntervalsPerRow;
+			INT NumIntervalsInRow = 0;
 
-					// Discard polys completely off screen.
-					if (OutQuad.XMax < 0 || OutQuad.XMin >= (INT) m_Width * m_MSFactor ||
-						OutQuad.YMax < 0 || OutQuad.YMin >= (INT) m_Height * m_MSFactor)
-					{
-						continue;
-					}
+			// Four uPolys at a time get their corners fetched and edge equations computed,
+			// for the previous (0) and current (1) positions.
+			for (INT x = 0; x < Grid.GetNumPolysX(); x += 4)
+			{
+				const INT NumLanes = Min(4, Grid.GetNumPolysX() - x);
 
-					// Clamp min & max to screen bounds to avoid worrying about it later.
-					OutQuad.XMin = Max(OutQuad.XMin, 0);
-					OutQuad.YMin = Max(OutQuad.YMin, 0);
-					OutQuad.XMax = Min(OutQuad.XMax, (INT) m_Width * m_MSFactor - 1);
-					OutQuad.YMax = Min(OutQuad.YMax, (INT) m_Height * m_MSFactor - 1);
+				XMVECTOR CornerXs[2][4], CornerYs[2][4];
+				for (int i = 0; i < 2; i++)
+				{
+					LoadFourQuadCorners(PixelXs[i], PixelYs[i], y * RowStride + x, RowStride, CornerXs[i], CornerYs[i]);
+				}
 
-					// Copy colour of first vert.
-					OutQuad.m_Colour = Grid.GetVert(x, y).colour;
+				cMovingEquations EdgeEquations[4];
+				BustFourMovingEdgeEquations(CornerXs, CornerYs, EdgeEquations);
 
-					// Copy edge equations.
-					for (int i = 0; i < 2; i++)
-						OutQuad.m_EdgeEquations[i] = EdgeEquations[i];
+				const INT FirstQuad = y * Grid.GetNumPolysX() + x;
+				for (INT Lane = 0; Lane < NumLanes; Lane++)
+				{
+					// Copy colour of first vert.
+					IntQuads[FirstQuad + Lane].m_EdgeEquations = EdgeEquations[Lane];
+					IntQuads[FirstQuad + Lane].m_Colour = Grid.GetColour(x + Lane, y);
+				}
 
-					// Add the resulting quad to the intermediate list.
-					IntQuads[NumIntQuads++] = OutQuad;
+				// Each time interval goes with the samples at one position in the pixel. The
+				// intervals' uPolys go in grid order, so every sample still sees the uPolys
+				// in grid order.
+				for (int py = 0; py < MSFactor; py++)
+				{
+					for (int px = 0; px < MSFactor; px++)
+					{
+						const float tMin = Prototype[py * MSFactor + px];
+						const float tMax = tMin + 1.0f / (float) NumIntervals;
+
+						// Bounds of the four uPolys over the interval.
+						XMVECTOR MinXs = XMVectorReplicate(FLT_MAX), MinYs = MinXs;
+						XMVECTOR MaxXs = -MinXs, MaxYs = MaxXs;
+						for (int c = 0; c < 4; c++)
+						{
+							const XMVECTOR X0 = XMVectorLerp(CornerXs[0][c], CornerXs[1][c], tMin);
+							const XMVECTOR Y0 = XMVectorLerp(CornerYs[0][c], CornerYs[1][c], tMin);
+							const XMVECTOR X1 = XMVectorLerp(CornerXs[0][c], CornerXs[1][c], tMax);
+							const XMVECTOR Y1 = XMVectorLerp(CornerYs[0][c], CornerYs[1][c], tMax);
+							MinXs = XMVectorMin(MinXs, XMVectorMin(X0, X1));
+							MinYs = XMVectorMin(MinYs, XMVectorMin(Y0, Y1));
+							MaxXs = XMVectorMax(MaxXs, XMVectorMax(X0, X1));
+							MaxYs = XMVectorMax(MaxYs, XMVectorMax(Y0, Y1));
+						}
+
+						// A sample's position is jittered by less than one sample right and down,
+						// so the samples that can be inside run from the one containing the
+						// minimum to the one containing the maximum.
+						XMFLOAT4A Bounds[4];
+						XMStoreFloat4A(&Bounds[0], XMVectorFloor(XMVectorClamp(MinXs, BoundsMin, BoundsMax)));
+						XMStoreFloat4A(&Bounds[1], XMVectorFloor(XMVectorClamp(MinYs, BoundsMinY, BoundsMaxY)));
+						XMStoreFloat4A(&Bounds[2], XMVectorFloor(XMVectorClamp(MaxXs, BoundsMin, BoundsMax)));
+						XMStoreFloat4A(&Bounds[3], XMVectorFloor(XMVectorClamp(MaxYs, BoundsMinY, BoundsMaxY)));
+
+						for (INT Lane = 0; Lane < NumLanes; Lane++)
+						{
+							cMotionBlurInterval OutInterval;
+							OutInterval.m_Quad = FirstQuad + Lane;
+
+							// Only the samples at this position in the pixel, within the buffer.
+							OutInterval.XMin = RoundUpToOffset((INT) (&Bounds[0].x)[Lane], px, MSFactor);
+							OutInterval.YMin = RoundUpToOffset((INT) (&Bounds[1].x)[Lane], py, MSFactor);
+							OutInterval.XMax = RoundDownToOffset((INT) (&Bounds[2].x)[Lane], px, MSFactor);
+							OutInterval.YMax = RoundDownToOffset((INT) (&Bounds[3].x)[Lane], py, MSFactor);
+
+							OutInterval.XMin = StepUpTo(OutInterval.XMin, m_BufferXMin, MSFactor);
+							OutInterval.YMin = StepUpTo(OutInterval.YMin, m_BufferYMin, MSFactor);
+							OutInterval.XMax = Min(OutInterval.XMax, m_BufferXMax);
+							OutInterval.YMax = Min(OutInterval.YMax, m_BufferYMax);
+
+							// Discard uPolys that miss every sample on this interval.
+							if (OutInterval.XMin > OutInterval.XMax || OutInterval.YMin > OutInterval.YMax)
+							{
+								continue;
+							}
+
+							RowIntervals[NumIntervalsInRow++] = OutInterval;
+						}
+					}
 				}
 			}
+
+			NumRowIntervals[y] = NumIntervalsInRow;
 		}
-	}
+	});
 
-	// Rasterize each uPoly.
-	for (INT nPoly = 0; nPoly < NumIntQuads; nPoly++)
+	// Sort the uPolys into tiles, keeping them in grid order.
+	cTileBins Bins(m_BufferOriginX, m_BufferOriginY, m_BufferXMax, m_BufferYMax, TileSizePixels * MSFactor);
+	for (INT y = 0; y < Grid.GetNumPolysY(); y++)
 	{
-		const cIntermediateQuadMotionBlur& Quad = IntQuads[nPoly];
+		for (INT i = y * IntervalsPerRow; i < y * IntervalsPerRow + NumRowIntervals[y]; i++)
+		{
+			const cMotionBlurInterval& Interval = Intervals[i];
+			Bins.Add(Interval.XMin, Interval.YMin, Interval.XMax, Interval.YMax, i);
+			AddDirtyRect(Interval.XMin, Interval.YMin, Interval.XMax, Interval.YMax);
+		}
+	}
 
-		// Each uPoly is only defined for 1 time period, so skip over the irrelevant ones.
-		for (INT Y = Quad.YMin; Y <= Quad.YMax; Y += m_MSFactor)
+	// Rasterize each tile's uPolys.
+	const cSamplePattern& Pattern = *m_SamplePattern;
+	const INT JitterSize = cSamplePattern::PatternSizePixels * MSFactor;
+	_ASSERTE(Pattern.GetSize() == JitterSize);
+	cTaskScheduler::Instance().ParallelFor(Bins.GetNumTiles(), 1, [&](int TileBegin, int TileEnd)
+	{
+		for (INT Tile = TileBegin; Tile < TileEnd; Tile++)
 		{
-			for (INT X = Quad.XMin; X <= Quad.XMax; X += m_MSFactor)
+			INT TileXMin, TileYMin, TileXMax, TileYMax;
+			Bins.GetTileRect(Tile, TileXMin, TileYMin, TileXMax, TileYMax);
+
+			const vector<INT>& Bin = Bins.GetBin(Tile);
+			for (vector<INT>::const_iterator it = Bin.begin(); it != Bin.end(); ++it)
 			{
-				auto xyt = XMVectorSetInt(X, Y, 0, 0);
+				const cMotionBlurInterval& Interval = Intervals[*it];
+				const cIntermediateQuadMotionBlur& Quad = IntQuads[Interval.m_Quad];
+
+				// Only touch the samples in this tile, staying on this uPoly's time interval.
+				const INT XMin = StepUpTo(Interval.XMin, TileXMin, MSFactor);
+				const INT YMin = StepUpTo(Interval.YMin, TileYMin, MSFactor);
+				const INT XMax = Min(Interval.XMax, TileXMax);
+				const INT YMax = Min(Interval.YMax, TileYMax);
+				if (XMin > XMax || YMin > YMax)
+				{
+					continue;
+				}
+				AllocateTiles(XMin, YMin, XMax, YMax);
+
+				const cMovingEquations& Eqns = Quad.m_EdgeEquations;
 
-				// Test sample location against edge equations.
-				const auto& Jitter = GetJitterWithT(X, Y);
-				xyt += Jitter;
+				// Steps between the samples on this uPoly's time interval.
+				const XMVECTOR Step = Eqns.As * (float) MSFactor;
+				const XMVECTOR RateStep = Eqns.dAs * (float) MSFactor;
 
-				// Test sample location against edge equations.
-				if (IsInsideFourTimeDependentEqns(Quad.m_EdgeEquations[0], Quad.m_EdgeEquations[1], xyt))
+				for (INT Y = YMin; Y <= YMax; Y += MSFactor)
 				{
-					m_MSBuffer[Y * m_Width * m_MSFactor + X] = Quad.m_Colour;
+					// The edge functions at the row's first sample point before jittering,
+					// and how fast they change with time, stepped along the row.
+					XMVECTOR Values = Eqns.As * (float) XMin + Eqns.Bs * (float) Y - Eqns.Cs;
+					XMVECTOR Rates = Eqns.dAs * (float) XMin + Eqns.dBs * (float) Y - Eqns.dCs;
+
+					const XMVECTOR* JitterRow = Pattern.GetRow(Y);
+
+					for (INT X = XMin; X <= XMax; X += MSFactor, Values += Step, Rates += RateStep)
+					{
+						// Move the edge functions to the jittered sample position, then to
+						// the sample's time.
+						const XMVECTOR Jitter = JitterRow[X % JitterSize];
+						const XMVECTOR JitterX = XMVectorSplatX(Jitter);
+						const XMVECTOR JitterY = XMVectorSplatY(Jitter);
+						const XMVECTOR T = XMVectorSplatZ(Jitter);
+						const XMVECTOR SampleValues = Values + Eqns.As * JitterX + Eqns.Bs * JitterY;
+						const XMVECTOR SampleRates = Rates + Eqns.dAs * JitterX + Eqns.dBs * JitterY;
+
+						// Test sample location against edge equations.
+						if (IsInsideFourEdges(SampleValues + T * (SampleRates - T * Eqns.ddCs)))
+						{
+							*GetSample(X, Y) = Quad.m_Colour;
+						}
+					}
 				}
 			}
 		}
-	}
-
-	AlignedFree(IntQuads);
+	});
 }
 
 //--------------------------------------------------------------------------------------
-// Fast implementation of pow for values between 0 and 1.
-// Taken from https://gist.github.com/Novum/1200562
+// Convert filtered colours and write them to a run of target pixels.
 //--------------------------------------------------------------------------------------
-inline XMVECTOR FastPow01(XMVECTOR x, XMVECTOR y)
+void cSoftwareRasterizer::WriteTargetPixels(INT x, INT y, const XMVECTOR* Colours, INT Count)
 {
-#if USE_SSE
-	static const __m128 fourOne = _mm_set1_ps(1.0f);
-	static const __m128 fourHalf = _mm_set1_ps(0.5f);
-
-	__m128 a = _mm_sub_ps(fourOne, y);
-	__m128 b = _mm_sub_ps(x, fourOne);
-	__m128 aSq = _mm_mul_ps(a, a);
-	__m128 bSq = _mm_mul_ps(b, b);
-	__m128 c = _mm_mul_ps(fourHalf, bSq);
-	__m128 d = _mm_sub_ps(b, c);
-	__m128 dSq = _mm_mul_ps(d, d);
-	__m128 e = _mm_mul_ps(aSq, dSq);
-	__m128 f = _mm_mul_ps(a, d);
-	__m128 g = _mm_mul_ps(fourHalf, e);
-	__m128 h = _mm_add_ps(fourOne, f);
-	__m128 i = _mm_add_ps(h, g);
-	__m128 iRcp = _mm_rcp_ps(i);
-	__m128 result = _mm_mul_ps(x, iRcp);
-
-	return result;
-#else
-#error TODO
-#endif
+	const size_t Offset = ((size_t) y * m_Width + x) * GetTargetFormatPixelSize(m_TargetFormat);
+	ConvertToTargetFormat(m_TargetFormat, m_CoverageKernel, Colours, Count, (BYTE*) m_TargetPixels + Offset);
 }
 
 //--------------------------------------------------------------------------------------
 // Downsample the multi-sampled render target to the backbuffer.
+//
+// Box filters no wider than a pixel read each sample once, so are done pixel by pixel.
+// Wider ones overlap their neighbours and use running sums instead (see
+// BoxFilterRows), so widening the filter doesn't slow the resolve down. The weighted
+// filters are done in two passes (see WeightedFilterRows).
+//
+// Each band of rows is done in chunks across, so that the tiles holding a row of a
+// chunk's samples are still in the cache when the rows below them are read.
 //--------------------------------------------------------------------------------------
-void cSoftwareRasterizer::DownsampleBuffer()
+template <INT MSFactor>
+void cSoftwareRasterizer::DownsampleBuffer(INT XMin, INT YMin, INT XMax, INT YMax)
 {
-	// Downsample the super-sampled buffer into the back buffer.
-	// (In a rather inefficient way)
-	for (UINT y = 0; y < m_Height; y++)
+	const bool bWeighted = m_ReconstructionFilter != ReconstructionFilter_Box;
+	const INT Offset = GetFilterOffset();
+	const bool bOverlapping = Offset > 0;
+	const INT ChunkPixels = ResolveChunkSamples / MSFactor;
+
+	// Downsample the super-sampled buffer into the back buffer, in parallel bands of rows.
+	cTaskScheduler::Instance().ParallelFor(YMax - YMin, ResolveGrain, [&](int RowBegin, int RowEnd)
 	{
-		for (UINT x = 0; x < m_Width; x++)
-		{
-			XMVECTOR FilteredColour = FilterPixel(x, y);
+		cLinearArena& Arena = cFrameArenas::Instance().GetThreadArena();
+		cArenaScope ArenaScope(Arena);
+		auto* Colours = Arena.Alloc<XMVECTOR>(ChunkPixels);
 
-			// Clamp to [0,1]
-			FilteredColour = XMVectorClamp(FilteredColour, XMVectorZero(), XMVectorSplatOne());
+		for (INT ChunkXMin = XMin; ChunkXMin < XMax; ChunkXMin += ChunkPixels)
+		{
+			const INT ChunkXMax = Min(ChunkXMin + ChunkPixels, XMax);
+
+			// If nothing was drawn in any of the tiles the chunk's filter windows read,
+			// its pixels are all the background, so skip filtering them.
+			if (IsUntouched(
+				Max(ChunkXMin * MSFactor - Offset, m_BufferXMin),
+				Max((YMin + RowBegin) * MSFactor - Offset, m_BufferYMin),
+				Min(ChunkXMax * MSFactor + Offset - 1, m_BufferXMax),
+				Min((YMin + RowEnd) * MSFactor + Offset - 1, m_BufferYMax)))
+			{
+				for (INT x = ChunkXMin; x < ChunkXMax; x++)
+				{
+					Colours[x - ChunkXMin] = XMVectorZero();
+				}
+				for (INT y = YMin + RowBegin; y < YMin + RowEnd; y++)
+				{
+					WriteTargetPixels(ChunkXMin, y, Colours, ChunkXMax - ChunkXMin);
+				}
+				continue;
+			}
 
-			// Gamma correct (not alpha).
-			auto GammaColour = FastPow01(FilteredColour, XMVectorReplicate(1.0f / 2.2f));
-			FilteredColour = XMVectorSelect(FilteredColour, GammaColour, XMVectorSelectControl(1, 1, 1, 0));
+			if (bWeighted)
+			{
+				WeightedFilterRows<MSFactor>(ChunkXMin, YMin + RowBegin, ChunkXMax, YMin + RowEnd);
+				continue;
+			}
+			if (bOverlapping)
+			{
+				BoxFilterRows<MSFactor>(ChunkXMin, YMin + RowBegin, ChunkXMax, YMin + RowEnd);
+				continue;
+			}
 
-			// Convert to BGRA32 format.
-			FilteredColour *= XMVectorReplicate(255.f);
-			UINT Colour =
-				((BYTE)XMVectorGetZ(FilteredColour) << 24) |
-				((BYTE)XMVectorGetY(FilteredColour) << 16) |
-				((BYTE)XMVectorGetX(FilteredColour) << 8) |
-				((BYTE)XMVectorGetW(FilteredColour) << 0);
+			// Filter a row of pixels at a time, then convert the row to the target.
+			for (INT y = YMin + RowBegin; y < YMin + RowEnd; y++)
+			{
+				for (INT x = ChunkXMin; x < ChunkXMax; x++)
+				{
+					Colours[x - ChunkXMin] = FilterPixel<MSFactor>(x, y);
+				}
 
-			// Assign to backbuffer.
-			m_TargetPixels[y*m_Width+x] = Colour;
+				// Assign to backbuffer.
+				WriteTargetPixels(ChunkXMin, y, Colours, ChunkXMax - ChunkXMin);
+			}
 		}
-	}
+	});
 }
 
 //--------------------------------------------------------------------------------------
-// Compute the colour for a pixel by filtering the supersampled buffer.
+// Box filter the pixel rectangle [XMin,XMax) x [YMin,YMax) to the target in time
+// independent of the filter width.
+//
+// Each row of samples is summed over each pixel's filter window as the difference of
+// two prefix sums along the row. Those window sums are then summed down each column
+// in the same way. The sums start afresh for each call, which keeps them small enough
+// for floats to stay accurate.
 //--------------------------------------------------------------------------------------
-XMVECTOR cSoftwareRasterizer::FilterPixel(int x, int y)
+template <INT MSFactor>
+void cSoftwareRasterizer::BoxFilterRows(INT XMin, INT YMin, INT XMax, INT YMax)
 {
-	const int Offset = (m_MSFilterWidth - m_MSFactor) / 2;
+	cLinearArena& Arena = cFrameArenas::Instance().GetThreadArena();
+	cArenaScope ArenaScope(Arena);
+
+	const INT Offset = GetFilterOffset();
+	const INT Width = XMax - XMin;
+	if (Width <= 0)
+		return;
+
+	// Every pixel's filter window, in samples, clamped to the screen.
+	auto* WindowXMins = Arena.Alloc<INT>(Width);
+	auto* WindowXMaxs = Arena.Alloc<INT>(Width);
+	for (INT x = XMin; x < XMax; x++)
+	{
+		WindowXMins[x - XMin] = Max(x * MSFactor - Offset, 0);
+		WindowXMaxs[x - XMin] = Min<INT>((x + 1) * MSFactor + Offset, m_Width * MSFactor);
+	}
 
-	int xMin = Max(x * m_MSFactor - Offset, 0);
-	int yMin = Max(y * m_MSFactor - Offset, 0);
-	int xMax = Min<int>((x+1) * m_MSFactor + Offset, m_Width * m_MSFactor - 1);
-	int yMax = Min<int>((y+1) * m_MSFactor + Offset, m_Height * m_MSFactor - 1);
+	// The samples any of the windows read.
+	const INT SampleXMin = WindowXMins[0];
+	const INT SampleXMax = WindowXMaxs[Width - 1];
+	const INT SampleYMin = Max(YMin * MSFactor - Offset, 0);
+	const INT SampleYMax = Min<INT>(YMax * MSFactor + Offset, m_Height * MSFactor);
 
-	float SampleCount = 0.0f;
+	// RowSums holds the prefix sums along the current sample row, and ColumnSums
+	// the window sums of every row above it, row by row, added up down each column.
+	auto* RowSums = Arena.Alloc<XMVECTOR>(SampleXMax - SampleXMin + 1);
+	auto* ColumnSums = Arena.Alloc<XMVECTOR>((SampleYMax - SampleYMin + 1) * Width);
 
-	XMVECTOR AverageColour = XMVectorZero();
-	for (int sy = yMin; sy < yMax; sy++)
+	for (INT x = 0; x < Width; x++)
 	{
-		for (int sx = xMin; sx < xMax; sx++)
+		ColumnSums[x] = XMVectorZero();
+	}
+
+	RowSums[0] = XMVectorZero();
+	for (INT sy = SampleYMin; sy < SampleYMax; sy++)
+	{
+		for (INT Left = SampleXMin; Left < SampleXMax; Left = GetSampleTileEnd(Left) + 1)
 		{
-			const tRenderTargetFormat& Sample = m_MSBuffer[sy * m_Width * m_MSFactor + sx];
-			AverageColour += XMLoadUShortN4(&Sample);
-			SampleCount += 1.0f;
+			const INT Right = Min(GetSampleTileEnd(Left) + 1, SampleXMax);
+			const tRenderTargetFormat* Sample = FindSample(Left, sy);
+			if (!Sample)
+			{
+				// An untouched tile's samples are all zero.
+				for (INT sx = Left; sx < Right; sx++)
+				{
+					RowSums[sx - SampleXMin + 1] = RowSums[sx - SampleXMin];
+				}
+				continue;
+			}
+			for (INT sx = Left; sx < Right; sx++, Sample++)
+			{
+				RowSums[sx - SampleXMin + 1] = RowSums[sx - SampleXMin] + XMLoadUShortN4(Sample);
+			}
+		}
+
+		const XMVECTOR* Above = ColumnSums + (sy - SampleYMin) * Width;
+		XMVECTOR* Below = ColumnSums + (sy - SampleYMin + 1) * Width;
+		for (INT x = 0; x < Width; x++)
+		{
+			Below[x] = Above[x] + RowSums[WindowXMaxs[x] - SampleXMin] - RowSums[WindowXMins[x] - SampleXMin];
 		}
 	}
 
-	// Average colour.
-	AverageColour /= SampleCount;
+	auto* Colours = Arena.Alloc<XMVECTOR>(Width);
+	for (INT y = YMin; y < YMax; y++)
+	{
+		const INT WindowYMin = Max(y * MSFactor - Offset, 0);
+		const INT WindowYMax = Min<INT>((y + 1) * MSFactor + Offset, m_Height * MSFactor);
+		const XMVECTOR* Top = ColumnSums + (WindowYMin - SampleYMin) * Width;
+		const XMVECTOR* Bottom = ColumnSums + (WindowYMax - SampleYMin) * Width;
 
-	return AverageColour;
+		for (INT x = 0; x < Width; x++)
+		{
+			const float SampleCount = (float) ((WindowXMaxs[x] - WindowXMins[x]) * (WindowYMax - WindowYMin));
+			Colours[x] = (Bottom[x] - Top[x]) / SampleCount;
+		}
+
+		// Assign to backbuffer.
+		WriteTargetPixels(XMin, y, Colours, Width);
+	}
 }
 
 //--------------------------------------------------------------------------------------
-// Initialise the jitter lookup table.
+// Filter the pixel rectangle [XMin,XMax) x [YMin,YMax) to the target with the weighted
+// filter.
+//
+// The filter is separable, so each row of samples the rectangle's windows cover is
+// first filtered across to one value per pixel, and those values are then filtered
+// down each column a pixel row at a time. Windows running off the screen only count
+// the weights of the samples on it.
 //--------------------------------------------------------------------------------------
-void cSoftwareRasterizer::InitJitterLookup(int MSFactor)
+template <INT MSFactor>
+void cSoftwareRasterizer::WeightedFilterRows(INT XMin, INT YMin, INT XMax, INT YMax)
 {
-	sm_JitterLookupMSFactor = MSFactor;
+	const INT Width = XMax - XMin;
+	if (Width <= 0)
+		return;
+
+	cLinearArena& Arena = cFrameArenas::Instance().GetThreadArena();
+	cArenaScope ArenaScope(Arena);
 
-	// Free previous data, if present.
-	AlignedFree(sm_JitterLookup);
+	const INT Offset = GetFilterOffset();
+	const INT NumTaps = m_FilterWeights.GetNumTaps();
+	const float* Weights = m_FilterWeights.GetWeights();
+	_ASSERTE(NumTaps == MSFactor + 2 * Offset);
 
-	// Allocate new table.
-	const int TableSize = GetJitterLookupSize() * GetJitterLookupSize();
-	sm_JitterLookup = AlignedAlloc<XMVECTOR>(TableSize);
+	const INT ScreenXMax = m_Width * MSFactor;
+	const INT ScreenYMax = m_Height * MSFactor;
 
-	// Seed the random number generator.
-	srand(0);
+	// The rows of samples any of the windows read, each filtered across.
+	const INT SampleYMin = Max(YMin * MSFactor - Offset, 0);
+	const INT SampleYMax = Min((YMax - 1) * MSFactor - Offset + NumTaps, ScreenYMax);
+	auto* Rows = Arena.Alloc<XMVECTOR>((SampleYMax - SampleYMin) * Width);
 
-	// Compute spatial jitter values -- simple random values that are added to the sample point.
-	for (int i = 0; i < TableSize; i++)
+	for (INT sy = SampleYMin; sy < SampleYMax; sy++)
 	{
-		sm_JitterLookup[i] = XMVectorSet(
-			(float) rand() / (float) RAND_MAX,
-			(float) rand() / (float) RAND_MAX,
-			0.0f, 0.0f);
+		XMVECTOR* Row = Rows + (sy - SampleYMin) * Width;
+		for (INT x = XMin; x < XMax; x++)
+		{
+			const INT First = x * MSFactor - Offset;
+			const INT TapMin = Max(-First, 0);
+			const INT TapMax = Min(ScreenXMax - First, NumTaps);
+
+			XMVECTOR Sum = XMVectorZero();
+			for (INT Left = TapMin; Left < TapMax; Left = GetSampleTileEnd(First + Left) + 1 - First)
+			{
+				const INT Right = Min(GetSampleTileEnd(First + Left) + 1 - First, TapMax);
+				const tRenderTargetFormat* Sample = FindSample(First + Left, sy);
+				if (!Sample)
+				{
+					// An untouched tile's samples are all zero.
+					continue;
+				}
+				for (INT i = Left; i < Right; i++, Sample++)
+				{
+					Sum += XMLoadUShortN4(Sample) * Weights[i];
+				}
+			}
+
+			if (TapMin > 0 || TapMax < NumTaps)
+			{
+				float WeightSum = 0.0f;
+				for (INT i = TapMin; i < TapMax; i++)
+					WeightSum += Weights[i];
+				Sum /= WeightSum;
+			}
+
+			Row[x - XMin] = Sum;
+		}
 	}
 
-	float* Prototype = GetPrototype(MSFactor);
+	// Filter down the columns into a pixel row at a time.
+	auto* Colours = Arena.Alloc<XMVECTOR>(Width);
+	for (INT y = YMin; y < YMax; y++)
+	{
+		const INT First = y * MSFactor - Offset;
+		const INT TapMin = Max(-First, 0);
+		const INT TapMax = Min(ScreenYMax - First, NumTaps);
+
+		for (INT x = 0; x < Width; x++)
+		{
+			Colours[x] = XMVectorZero();
+		}
 
-	// Compute temporal jitter. Based on prototype pattern.
-	for (int y = 0; y < GetJitterLookupSize(); y+=MSFactor)
+		float WeightSum = 0.0f;
+		for (INT i = TapMin; i < TapMax; i++)
+		{
+			const XMVECTOR* Row = Rows + (First + i - SampleYMin) * Width;
+			const XMVECTOR Weight = XMVectorReplicate(Weights[i]);
+			for (INT x = 0; x < Width; x++)
+			{
+				Colours[x] += Row[x] * Weight;
+			}
+			WeightSum += Weights[i];
+		}
+
+		const XMVECTOR Scale = XMVectorReplicate(1.0f / WeightSum);
+		for (INT x = 0; x < Width; x++)
+		{
+			Colours[x] *= Scale;
+		}
+
+		// Assign to backbuffer.
+		WriteTargetPixels(XMin, y, Colours, Width);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Compute the colour for a pixel by filtering the supersampled buffer.
+//--------------------------------------------------------------------------------------
+template <INT MSFactor>
+XMVECTOR cSoftwareRasterizer::FilterPixel(int x, int y)
+{
+	const int Offset = GetFilterOffset();
+
+	int xMin = Max(x * MSFactor - Offset, 0);
+	int yMin = Max(y * MSFactor - Offset, 0);
+	int xMax = Min<int>((x+1) * MSFactor + Offset, m_Width * MSFactor);
+	int yMax = Min<int>((y+1) * MSFactor + Offset, m_Height * MSFactor);
+
+	float SampleCount = 0.0f;
+
+	XMVECTOR AverageColour = XMVectorZero();
+	for (int Left = xMin; Left < xMax; Left = GetSampleTileEnd(Left) + 1)
 	{
-		for (int x = 0; x < GetJitterLookupSize(); x+=MSFactor)
+		const int Right = Min(GetSampleTileEnd(Left) + 1, xMax);
+		for (int sy = yMin; sy < yMax; sy++)
 		{
-			for (int sy = 0; sy < MSFactor; sy++)
+			const tRenderTargetFormat* Sample = FindSample(Left, sy);
+			if (!Sample)
 			{
-				for (int sx = 0; sx < MSFactor; sx++)
-				{
-					const float t = Prototype[sy * MSFactor + sx] +
-						((float) rand() / (float) RAND_MAX) / (float) (MSFactor * MSFactor);
-					auto& dest = sm_JitterLookup[(y + sy) * GetJitterLookupSize() + x + sx];
-					dest = XMVectorSetZ(dest, t);
-				}
+				// An untouched tile's samples are all zero.
+				SampleCount += (float) (Right - Left);
+				continue;
+			}
+			for (int sx = Left; sx < Right; sx++, Sample++)
+			{
+				AverageColour += XMLoadUShortN4(Sample);
+				SampleCount += 1.0f;
 			}
 		}
 	}
+
+	// Average colour.
+	AverageColour /= SampleCount;
+
+	return AverageColour;
 }
+
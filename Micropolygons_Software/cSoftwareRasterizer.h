@@ -2,37 +2,176 @@
 
 #include "iRasterizer.h"
 #include "Utility.h"
+#include "cLinearArena.h"
+#include "cCoverageKernels.h"
+#include "cSamplePattern.h"
+#include "cReconstructionFilter.h"
+#include "cTargetFormat.h"
+#include <atomic>
+#include <vector>
 
 class cSoftwareRasterizer : public MicropolygonCommon::iRasterizer
 {
+	// Format of the super-sampled buffer.
+	typedef XMUSHORTN4 tRenderTargetFormat;
+
 public:
 
-	// Constructor
-	cSoftwareRasterizer(UINT Width, UINT Height, INT MSFactor, float FilterWidth, DWORD* TargetPixels)
-		: m_Width(Width)
-		, m_Height(Height)
-		, m_MSFactor(MSFactor)
-		, m_MSFilterWidth((INT) (FilterWidth * MSFactor))
-		, m_TargetPixels(TargetPixels)
+	// Constructor. Call SetParameters before rendering.
+	cSoftwareRasterizer()
+		: m_Width(0)
+		, m_Height(0)
+		, m_MSFactor(1)
+		, m_MSFilterWidth(1)
+		, m_TargetPixels(NULL)
+		, m_TargetFormat(TargetFormat_BGRA8)
+		, m_TilePool(NULL)
+		, m_TilePoolCapacity(0)
+		, m_NumPoolTilesUsed(0)
+		, m_BufferXMin(0), m_BufferYMin(0), m_BufferXMax(-1), m_BufferYMax(-1)
+		, m_BufferOriginX(0), m_BufferOriginY(0)
+		, m_NumTilesX(0), m_NumTilesY(0)
+		, m_bScreenNeedsClear(false)
+		, m_bScreenUsed(false)
+		, m_DirtyXMin(INT_MAX), m_DirtyYMin(INT_MAX), m_DirtyXMax(INT_MIN), m_DirtyYMax(INT_MIN)
+		, m_bInBucket(false)
+		, m_CoverageKernel(GetBestCoverageKernel())
+		, m_bFixedPoint(false)
+		, m_ReconstructionFilter(ReconstructionFilter_Box)
+		, m_MSFunctions(GetMSFunctions(1))
+		, m_SamplePattern(cSamplePattern::Get(1))
 	{
-		// Allocate super-sampled render target.
-		m_MSBuffer = MicropolygonCommon::AlignedAlloc<tRenderTargetFormat>(Width * Height * MSFactor * MSFactor);
+		// The super-sampled buffer is allocated on demand, sized for either the whole
+		// screen or a single bucket. It is kept between frames.
 	}
 
 	~cSoftwareRasterizer()
 	{
-		MicropolygonCommon::AlignedFree(m_MSBuffer);
+		MicropolygonCommon::AlignedFree(m_TilePool);
 	}
 
+	// Set the target to resolve to and how to sample it. Can be called between frames;
+	// the super-sampled buffer is only reallocated if it needs to grow. The multisample
+	// factor must be supported. The target holds Width x Height pixels of the format,
+	// with no padding between rows.
+	void SetParameters(UINT Width, UINT Height, INT MSFactor, float FilterWidth, void* TargetPixels,
+		eTargetFormat TargetFormat = TargetFormat_BGRA8);
+
+	// Multisample factors the rasterizer is specialised for: 1, 2, 4, 8 and 16.
+	static bool IsMSFactorSupported(INT MSFactor) { return GetMSFunctions(MSFactor) != NULL; }
+
+	// Choose the kernel that fills the samples a uPoly covers. Defaults to the widest
+	// the CPU supports.
+	void SetCoverageKernel(eCoverageKernel Kernel)
+	{
+		_ASSERTE(IsCoverageKernelSupported(Kernel));
+		m_CoverageKernel = Kernel;
+	}
+	eCoverageKernel GetCoverageKernel() const { return m_CoverageKernel; }
+
+	// Rasterize in fixed point: snap uPoly corners and sample positions to sub-samples
+	// and test them exactly, so the result doesn't depend on the kernel. Only applies
+	// to grids without motion blur, and uPolys too big for fixed point still use floats.
+	void SetFixedPoint(bool bFixedPoint) { m_bFixedPoint = bFixedPoint; }
+	bool IsFixedPoint() const { return m_bFixedPoint; }
+
+	// Choose the filter the super-sampled buffer is resolved with. Defaults to a box.
+	// Can be changed between frames.
+	void SetReconstructionFilter(eReconstructionFilter Filter) { m_ReconstructionFilter = Filter; }
+	eReconstructionFilter GetReconstructionFilter() const { return m_ReconstructionFilter; }
+
 	// Rasterize a set of micropolygons using the CPU.
 	virtual void RasterizeGrid(const MicropolygonCommon::cGrid& Grid);
 
+	// Frames. Only the target pixels that grids were rasterized to get resolved; the
+	// rest are left alone.
+	virtual void BeginFrame();
+	virtual void EndFrame();
+
+	// Bucketed rendering.
+	virtual bool SupportsBuckets() const { return true; }
+	virtual void BeginBucket(int XMin, int YMin, int XMax, int YMax);
+	virtual void EndBucket();
+	virtual int GetBucketMargin() const;
+
 private:
 
-	void RasterizeGridStandard(const MicropolygonCommon::cGrid& Grid);
-	void RasterizeGridMotionBlur(const MicropolygonCommon::cGrid& Grid);
+	// The hot paths are compiled separately for each supported multisample factor, and
+	// the set to use picked when the parameters are set.
+	class cMSFunctions
+	{
+	public:
+		void (cSoftwareRasterizer::*m_RasterizeGridStandard)(const MicropolygonCommon::cGrid& Grid);
+		void (cSoftwareRasterizer::*m_RasterizeGridMotionBlur)(const MicropolygonCommon::cGrid& Grid);
+		void (cSoftwareRasterizer::*m_DownsampleBuffer)(INT XMin, INT YMin, INT XMax, INT YMax);
+	};
+
+	static const cMSFunctions* GetMSFunctions(INT MSFactor);
+	template <INT MSFactor> static cMSFunctions MakeMSFunctions();
+
+	template <INT MSFactor> void RasterizeGridStandard(const MicropolygonCommon::cGrid& Grid);
+	template <INT MSFactor> void RasterizeGridMotionBlur(const MicropolygonCommon::cGrid& Grid);
+
+	// Transform every vertex of a grid to pixel space, multi-sampled or not.
+	void ProjectGridVerts(const MicropolygonCommon::cGrid& Grid, CXMMATRIX Transform, bool bMultiSampled,
+		MicropolygonCommon::cLinearArena& Arena, float*& PixelXs, float*& PixelYs);
+
+	// Point the super-sampled buffer at a region of the screen (in samples, inclusive)
+	// with every tile untouched, growing the pool if needed.
+	void SetBufferRegion(INT XMin, INT YMin, INT XMax, INT YMax);
+
+	// Give memory, cleared, to each tile that an inclusive rectangle of samples overlaps,
+	// if it hasn't any yet. Only one thread may be drawing in a tile at a time.
+	void AllocateTiles(INT XMin, INT YMin, INT XMax, INT YMax);
+
+	// Are all of an inclusive rectangle of samples in untouched tiles?
+	bool IsUntouched(INT XMin, INT YMin, INT XMax, INT YMax) const;
+
+	// Get the buffer ready for the first full-screen grid of a frame, clearing only
+	// what the last full-screen frame dirtied if it's still there.
+	void PrepareScreenBuffer();
+
+	// Grow the dirty rectangle to include some samples.
+	void AddDirtyRect(INT XMin, INT YMin, INT XMax, INT YMax);
+
+	// Downsample the pixel rectangle [XMin,XMax) x [YMin,YMax) to the target.
+	template <INT MSFactor> void DownsampleBuffer(INT XMin, INT YMin, INT XMax, INT YMax);
+	template <INT MSFactor> void BoxFilterRows(INT XMin, INT YMin, INT XMax, INT YMax);
+	template <INT MSFactor> void WeightedFilterRows(INT XMin, INT YMin, INT XMax, INT YMax);
+
+	// Convert filtered colours and write them to a run of target pixels.
+	void WriteTargetPixels(INT x, INT y, const XMVECTOR* Colours, INT Count);
 
-	void DownsampleBuffer();
+	// Number of samples either side of a pixel's own that the filter reads.
+	INT GetFilterOffset() const { return (m_MSFilterWidth - m_MSFactor) / 2; }
+
+	// Index in m_Tiles of the tile a sample is in.
+	INT GetTileIndex(INT X, INT Y) const
+	{
+		_ASSERTE(X >= m_BufferXMin && X <= m_BufferXMax);
+		_ASSERTE(Y >= m_BufferYMin && Y <= m_BufferYMax);
+		return ((Y - m_BufferOriginY) / SampleTileSize) * m_NumTilesX + (X - m_BufferOriginX) / SampleTileSize;
+	}
+
+	// Access a sample in the buffer by its screen sample coordinates. The samples after
+	// it along the row are only contiguous up to the end of its tile (see
+	// SampleTileSize). FindSample returns NULL if the tile is untouched, when every
+	// sample in it is the background; GetSample expects the tile to have memory.
+	tRenderTargetFormat* FindSample(INT X, INT Y) const
+	{
+		tRenderTargetFormat* Tile = m_Tiles[GetTileIndex(X, Y)];
+		if (!Tile)
+		{
+			return NULL;
+		}
+		return Tile + ((Y - m_BufferOriginY) % SampleTileSize) * SampleTileSize + (X - m_BufferOriginX) % SampleTileSize;
+	}
+	tRenderTargetFormat* GetSample(INT X, INT Y) const
+	{
+		tRenderTargetFormat* Sample = FindSample(X, Y);
+		_ASSERTE(Sample);
+		return Sample;
+	}
 
 	// Convert Normalised screen space to multi-sampled pixel space.
 	float ToMSPixelX(float x) const
@@ -67,45 +206,50 @@ private:
 	}
 
 	// Compute the colour for a pixel by filtering the supersampled buffer.
-	XMVECTOR FilterPixel(int x, int y);
+	template <INT MSFactor> XMVECTOR FilterPixel(int x, int y);
 
 	UINT	m_Width;
 	UINT	m_Height;
 	INT		m_MSFactor;
 	INT		m_MSFilterWidth;
-	DWORD*	m_TargetPixels;
-
-	// The super-sampled buffer.
-	typedef XMUSHORTN4 tRenderTargetFormat;
-	tRenderTargetFormat*	m_MSBuffer;
-
-	// Jitter lookup buffer to ensure sampling locations are coherent temporally.
-	enum { JitterLookupSizePixels = 32 };
-	static XMVECTOR*	sm_JitterLookup;
-	static int			sm_JitterLookupMSFactor;
-
-	static void InitJitterLookup(int MSFactor);
-	static int GetJitterLookupSize() { return JitterLookupSizePixels * sm_JitterLookupMSFactor; }
-
-	static const XMVECTOR GetJitter(XMVECTOR xy)
-	{
-		// Arbitrary scale to apply to randomise the coordinates.
-		static const XMVECTORF32 Scale = { 10.32854f, 7.2029f, 0.0f, 0.0f };
-
-		auto x = XMVectorSplatX(xy);
-		auto y = XMVectorSplatY(xy);
-
-		// Mush the x & y together and apply scale.
-		auto permuted = (x * y) * Scale;
-
-		// Take fractional portion.
-		return permuted - _mm_cvtepi32_ps(_mm_cvttps_epi32(permuted));
-	}
-
-	static const XMVECTOR& GetJitterWithT(int x, int y)
-	{
-		x = x % GetJitterLookupSize();
-		y = y % GetJitterLookupSize();
-		return sm_JitterLookup[y * GetJitterLookupSize() + x];
-	}
+	void*			m_TargetPixels;
+	eTargetFormat	m_TargetFormat;
+
+	// The super-sampled buffer, covering samples [m_BufferXMin,m_BufferXMax] x
+	// [m_BufferYMin,m_BufferYMax] of the screen. It's stored in tiles, the first
+	// starting at (m_BufferOriginX, m_BufferOriginY), the start of the tile
+	// (m_BufferXMin, m_BufferYMin) is in. m_Tiles holds each tile's samples, row by
+	// row of tiles, or NULL for a tile nothing has been drawn in since the buffer was
+	// cleared. A tile's memory is taken from the pool, and cleared, when it's first
+	// drawn in, so clearing the buffer only has to empty the table and the pool.
+	tRenderTargetFormat*	m_TilePool;
+	INT						m_TilePoolCapacity;
+	std::atomic<INT>		m_NumPoolTilesUsed;
+	std::vector<tRenderTargetFormat*>	m_Tiles;
+	INT						m_BufferXMin, m_BufferYMin, m_BufferXMax, m_BufferYMax;
+	INT						m_BufferOriginX, m_BufferOriginY;
+	INT						m_NumTilesX, m_NumTilesY;
+
+	// Full-screen rendering. The buffer needs clearing before the frame's first grid,
+	// and resolving at the end of the frame if any grids were drawn. The dirty
+	// rectangle holds the samples written since the buffer was last cleared.
+	bool	m_bScreenNeedsClear;
+	bool	m_bScreenUsed;
+	INT		m_DirtyXMin, m_DirtyYMin, m_DirtyXMax, m_DirtyYMax;
+
+	// Current bucket, in pixels, when rendering in buckets.
+	bool	m_bInBucket;
+	INT		m_BucketXMin, m_BucketYMin, m_BucketXMax, m_BucketYMax;
+
+	eCoverageKernel	m_CoverageKernel;
+	bool			m_bFixedPoint;
+
+	// The resolve filter, and its weights for the current settings.
+	eReconstructionFilter	m_ReconstructionFilter;
+	cFilterWeights			m_FilterWeights;
+
+	const cMSFunctions*	m_MSFunctions;
+
+	// Where the samples are, shared with every other rasterizer using the same factor.
+	const cSamplePattern*	m_SamplePattern;
 };
@@ -0,0 +1,299 @@
+#include "stdafx.h"
+#include "cTargetFormat.h"
+#include "Maths.h"
+#include <immintrin.h>
+#include <math.h>
+
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2		__attribute__((target("avx2,f16c")))
+#endif
+
+namespace
+{
+
+//--------------------------------------------------------------------------------------
+// Tables for encoding linear values as 8-bit sRGB, built on first use.
+//
+// A 16-bit linear value is enough to look up the answer to within one step, as even
+// the darkest 8-bit steps are many 16-bit values wide, but a value within half a
+// 16-bit step of a rounding threshold can land on the wrong side of it. So the
+// lookup is corrected by comparing the value itself against the thresholds either
+// side, which makes the result exactly the curve's value rounded to 8 bits. Only the
+// few 16-bit values next to a threshold need that, and they're marked in the table.
+//--------------------------------------------------------------------------------------
+class cSRGBTables
+{
+public:
+
+	cSRGBTables()
+	{
+		// The smallest float that encodes to k or above, from the inverse curve.
+		m_Starts[0] = -1.0f;
+		for (int k = 1; k < 256; k++)
+		{
+			const double Encoded = (k - 0.5) / 255.0;
+			const double Linear = Encoded <= 0.04045 ? Encoded / 12.92 : pow((Encoded + 0.055) / 1.055, 2.4);
+			float Threshold = (float) Linear;
+			if (Threshold < Linear)
+			{
+				Threshold = nextafterf(Threshold, 2.0f);
+			}
+			m_Starts[k] = Threshold;
+		}
+		m_Starts[256] = 2.0f;
+
+		for (int i = 0, k = 0; i < 65536; i++)
+		{
+			while ((float) i / 65535.0f >= m_Starts[k + 1])
+			{
+				k++;
+			}
+			m_Values[i] = (uint16_t) k;
+		}
+
+		// Anything quantised to i lies strictly between i - 1 and i + 1, so if they
+		// encode the same, so does it.
+		for (int i = 0; i < 65536; i++)
+		{
+			const int Below = m_Values[Max(i - 1, 0)] & 0xFF;
+			const int Above = m_Values[Min(i + 1, 65535)] & 0xFF;
+			if (Below != Above)
+			{
+				m_Values[i] |= NearThreshold;
+			}
+		}
+	}
+
+	enum { NearThreshold = 0x100 };
+
+	// sRGB values of 16-bit linear values in the bottom byte, and whether they need
+	// checking against the thresholds.
+	uint16_t	m_Values[65536];
+
+	// The smallest linear value that encodes to each sRGB value, then one past the
+	// end, so the thresholds either side of any value can be read without checks.
+	float		m_Starts[257];
+};
+
+const cSRGBTables& GetSRGBTables()
+{
+	static const cSRGBTables Tables;
+	return Tables;
+}
+
+//--------------------------------------------------------------------------------------
+// Saturate four colours and transpose them to a vector per channel. Colours past
+// Count are black.
+//--------------------------------------------------------------------------------------
+void LoadChannels(const XMVECTOR* Colours, INT First, INT Count, XMVECTOR* Channels)
+{
+	for (INT p = 0; p < 4; p++)
+	{
+		Channels[p] = XMVectorSaturate(First + p < Count ? Colours[First + p] : XMVectorZero());
+	}
+	_MM_TRANSPOSE4_PS(Channels[0], Channels[1], Channels[2], Channels[3]);
+}
+
+//--------------------------------------------------------------------------------------
+// BGRA8 packing: blue in the top byte, alpha in the bottom.
+//--------------------------------------------------------------------------------------
+inline __m128i PackBGRA8(__m128i Rs, __m128i Gs, __m128i Bs, __m128i As)
+{
+	return _mm_or_si128(
+		_mm_or_si128(_mm_slli_epi32(Bs, 24), _mm_slli_epi32(Gs, 16)),
+		_mm_or_si128(_mm_slli_epi32(Rs, 8), As));
+}
+
+//--------------------------------------------------------------------------------------
+// Encode a channel of four pixels as sRGB. The values are looked up one by one, then
+// if any are near a threshold, each is moved up or down a step if it's past the
+// thresholds either side.
+//--------------------------------------------------------------------------------------
+__m128i EncodeSRGB(const cSRGBTables& SRGB, XMVECTOR Linears)
+{
+	const __m128i Quantised = _mm_cvtps_epi32(Linears * 65535.0f);
+	const INT Entries[4] =
+	{
+		SRGB.m_Values[_mm_cvtsi128_si32(Quantised)],
+		SRGB.m_Values[_mm_cvtsi128_si32(_mm_shuffle_epi32(Quantised, 1))],
+		SRGB.m_Values[_mm_cvtsi128_si32(_mm_shuffle_epi32(Quantised, 2))],
+		SRGB.m_Values[_mm_cvtsi128_si32(_mm_shuffle_epi32(Quantised, 3))],
+	};
+	if (!((Entries[0] | Entries[1] | Entries[2] | Entries[3]) & cSRGBTables::NearThreshold))
+	{
+		return _mm_setr_epi32(Entries[0], Entries[1], Entries[2], Entries[3]);
+	}
+
+	const INT V0 = Entries[0] & 0xFF;
+	const INT V1 = Entries[1] & 0xFF;
+	const INT V2 = Entries[2] & 0xFF;
+	const INT V3 = Entries[3] & 0xFF;
+
+	const __m128 Starts = _mm_setr_ps(SRGB.m_Starts[V0], SRGB.m_Starts[V1], SRGB.m_Starts[V2], SRGB.m_Starts[V3]);
+	const __m128 Ends = _mm_setr_ps(SRGB.m_Starts[V0 + 1], SRGB.m_Starts[V1 + 1], SRGB.m_Starts[V2 + 1], SRGB.m_Starts[V3 + 1]);
+
+	// Comparisons are -1 where true.
+	const __m128i Up = _mm_castps_si128(_mm_cmpge_ps(Linears, Ends));
+	const __m128i Down = _mm_castps_si128(_mm_cmplt_ps(Linears, Starts));
+	return _mm_add_epi32(_mm_sub_epi32(_mm_setr_epi32(V0, V1, V2, V3), Up), Down);
+}
+
+//--------------------------------------------------------------------------------------
+// BGRA8, four pixels at a time. The colour channels are encoded as sRGB, and alpha
+// quantised straight to 8 bits.
+//--------------------------------------------------------------------------------------
+void ConvertToBGRA8(const XMVECTOR* Colours, INT Count, DWORD* Dest)
+{
+	const cSRGBTables& SRGB = GetSRGBTables();
+
+	for (INT i = 0; i < Count; i += 4)
+	{
+		XMVECTOR Channels[4];
+		LoadChannels(Colours, i, Count, Channels);
+
+		const __m128i Packed = PackBGRA8(EncodeSRGB(SRGB, Channels[0]), EncodeSRGB(SRGB, Channels[1]),
+			EncodeSRGB(SRGB, Channels[2]), _mm_cvtps_epi32(Channels[3] * 255.0f));
+
+		const INT NumPixels = Min(4, Count - i);
+		if (NumPixels == 4)
+		{
+			_mm_storeu_si128((__m128i*) (Dest + i), Packed);
+		}
+		else
+		{
+			DWORD Pixels[4];
+			_mm_storeu_si128((__m128i*) Pixels, Packed);
+			memcpy(Dest + i, Pixels, NumPixels * sizeof(DWORD));
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// RGBA16, two pixels at a time. As in PackUShortN4x4, the channels are biased down so
+// the signed saturating pack keeps the full unsigned range.
+//--------------------------------------------------------------------------------------
+void ConvertToRGBA16(const XMVECTOR* Colours, INT Count, XMUSHORTN4* Dest)
+{
+	const XMVECTOR Scale = XMVectorReplicate(65535.0f);
+	const __m128i Bias = _mm_set1_epi32(32768);
+	const __m128i Unbias = _mm_set1_epi16((short) 0x8000);
+	auto ToBiasedInt = [&](FXMVECTOR c)
+	{
+		return _mm_sub_epi32(_mm_cvtps_epi32(XMVectorSaturate(c) * Scale), Bias);
+	};
+
+	INT i = 0;
+	for (; i + 1 < Count; i += 2)
+	{
+		const __m128i Packed = _mm_packs_epi32(ToBiasedInt(Colours[i]), ToBiasedInt(Colours[i + 1]));
+		_mm_storeu_si128((__m128i*) (Dest + i), _mm_xor_si128(Packed, Unbias));
+	}
+
+	if (i < Count)
+	{
+		const __m128i Packed = _mm_packs_epi32(ToBiasedInt(Colours[i]), _mm_setzero_si128());
+		_mm_storel_epi64((__m128i*) (Dest + i), _mm_xor_si128(Packed, Unbias));
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// RGBA16F. Without F16C each channel is converted on its own.
+//--------------------------------------------------------------------------------------
+void ConvertToRGBA16F(const XMVECTOR* Colours, INT Count, XMHALF4* Dest)
+{
+	for (INT i = 0; i < Count; i++)
+	{
+		XMStoreHalf4(Dest + i, XMVectorSaturate(Colours[i]));
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// AVX2 and F16C: RGBA16F, two pixels at a time.
+//--------------------------------------------------------------------------------------
+TARGET_AVX2 void ConvertToRGBA16F_AVX2(const XMVECTOR* Colours, INT Count, XMHALF4* Dest)
+{
+	const __m256 Zero = _mm256_setzero_ps();
+	const __m256 One = _mm256_set1_ps(1.0f);
+
+	INT i = 0;
+	for (; i + 1 < Count; i += 2)
+	{
+		const __m256 Pair = _mm256_insertf128_ps(_mm256_castps128_ps256(Colours[i]), Colours[i + 1], 1);
+		const __m128i Halves = _mm256_cvtps_ph(_mm256_min_ps(_mm256_max_ps(Pair, Zero), One), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*) (Dest + i), Halves);
+	}
+
+	if (i < Count)
+	{
+		const __m128i Halves = _mm_cvtps_ph(_mm_min_ps(_mm_max_ps(Colours[i], _mm_setzero_ps()), _mm_set1_ps(1.0f)), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storel_epi64((__m128i*) (Dest + i), Halves);
+	}
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------
+// Get a format's name, for display.
+//--------------------------------------------------------------------------------------
+const char* GetTargetFormatName(eTargetFormat Format)
+{
+	switch (Format)
+	{
+	case TargetFormat_RGBA16:	return "RGBA16";
+	case TargetFormat_RGBA16F:	return "RGBA16F";
+	default:					return "BGRA8";
+	}
+}
+
+UINT GetTargetFormatPixelSize(eTargetFormat Format)
+{
+	switch (Format)
+	{
+	case TargetFormat_RGBA16:	return sizeof(XMUSHORTN4);
+	case TargetFormat_RGBA16F:	return sizeof(XMHALF4);
+	default:					return sizeof(DWORD);
+	}
+}
+
+float LinearToSRGB(float Linear)
+{
+	return Linear <= 0.0031308f ? Linear * 12.92f : 1.055f * powf(Linear, 1.0f / 2.4f) - 0.055f;
+}
+
+//--------------------------------------------------------------------------------------
+// Convert a run of filtered colours to the format. The AVX-512 kernel's CPUs have
+// AVX2 too, so use its conversions. BGRA8 and RGBA16 don't have any.
+//--------------------------------------------------------------------------------------
+void ConvertToTargetFormat(eTargetFormat Format, eCoverageKernel Kernel, const XMVECTOR* Colours, INT Count, void* Dest)
+{
+	_ASSERTE(IsCoverageKernelSupported(Kernel));
+	const bool bAVX2 = Kernel != CoverageKernel_SSE;
+
+	switch (Format)
+	{
+	case TargetFormat_BGRA8:
+		ConvertToBGRA8(Colours, Count, (DWORD*) Dest);
+		break;
+
+	case TargetFormat_RGBA16:
+		ConvertToRGBA16(Colours, Count, (XMUSHORTN4*) Dest);
+		break;
+
+	case TargetFormat_RGBA16F:
+		if (bAVX2)
+		{
+			ConvertToRGBA16F_AVX2(Colours, Count, (XMHALF4*) Dest);
+		}
+		else
+		{
+			ConvertToRGBA16F(Colours, Count, (XMHALF4*) Dest);
+		}
+		break;
+
+	default:
+		_ASSERT(0);
+		break;
+	}
+}
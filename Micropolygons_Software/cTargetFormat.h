@@ -0,0 +1,30 @@
+#pragma once
+
+#include "cCoverageKernels.h"
+
+//--------------------------------------------------------------------------------------
+// Pixel formats the super-sampled buffer can be resolved to. The 8-bit format is for
+// display, so is sRGB encoded; the wider ones keep the colours linear for further
+// processing. Every format is clamped to [0,1].
+//--------------------------------------------------------------------------------------
+
+enum eTargetFormat
+{
+	TargetFormat_BGRA8,		// A DWORD per pixel: blue in the top byte, alpha in the bottom.
+	TargetFormat_RGBA16,	// Four 16-bit normalised channels, linear.
+	TargetFormat_RGBA16F,	// Four half floats, linear.
+
+	NumTargetFormats
+};
+
+const char* GetTargetFormatName(eTargetFormat Format);
+
+// Bytes per pixel.
+UINT GetTargetFormatPixelSize(eTargetFormat Format);
+
+// The sRGB transfer function, for a linear value in [0,1].
+float LinearToSRGB(float Linear);
+
+// Convert a run of filtered colours to the format, writing Count pixels to Dest. The
+// conversions use the same instruction set as the coverage kernel.
+void ConvertToTargetFormat(eTargetFormat Format, eCoverageKernel Kernel, const XMVECTOR* Colours, INT Count, void* Dest);
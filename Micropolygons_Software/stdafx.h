@@ -8,6 +8,8 @@
 // Disable STL exceptions.
 #define _HAS_EXCEPTIONS 0
 
+#ifdef _WIN32
+
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
@@ -18,19 +20,35 @@
 
 #include <windows.h>
 
+#else
+
+// Windows types and macros for other platforms (the rasterizer is shared with
+// the headless front end).
+#include "Platform.h"
+
+#endif
+
+#ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable:4838)
+#endif
 #include <DirectXMath.h>
 #include <DirectXPackedVector.h>
 using namespace DirectX;
 using namespace DirectX::PackedVector;
+#ifdef _MSC_VER
 #pragma warning(pop)
+#endif
 
+#ifdef _WIN32
 #include <crtdbg.h>
-
 #include <malloc.h>
+#endif
+
 #include <limits.h>
 #include <stdlib.h>
 #include <stdint.h>
 
+#ifdef _MSC_VER
 #pragma warning(disable:4201) // nonstandard extension used: nameless struct/union
+#endif